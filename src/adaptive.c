@@ -0,0 +1,80 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "adaptive.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <librfn.h>
+
+void adaptive_init(adaptive_t *a, uint64_t min_interval,
+		   uint64_t max_interval)
+{
+	memset(a, 0, sizeof(*a));
+
+	if (max_interval < min_interval)
+		max_interval = min_interval;
+
+	a->floor = min_interval;
+	a->ceiling = max_interval;
+	a->interval = min_interval;
+}
+
+void adaptive_set_threshold(adaptive_t *a, unsigned int ch, int32_t threshold)
+{
+	assert(ch < lengthof(a->channel));
+	a->channel[ch].threshold = threshold;
+}
+
+void adaptive_update(adaptive_t *a, unsigned int ch, int32_t value)
+{
+	assert(ch < lengthof(a->channel));
+	adaptive_channel_t *c = &a->channel[ch];
+
+	if (!c->valid) {
+		c->last = value;
+		c->valid = true;
+		return;
+	}
+
+	int32_t delta = value - c->last;
+	c->last = value;
+
+	if (c->threshold <= 0)
+		return;
+
+	if (abs(delta) > c->threshold) {
+		a->moving = true;
+		return;
+	}
+
+	/* would the current trend cross the threshold if we back off? */
+	if (2 * abs(delta) > c->threshold)
+		a->holding = true;
+}
+
+uint64_t adaptive_next_interval(adaptive_t *a)
+{
+	if (a->moving) {
+		a->interval = a->floor;
+	} else if (!a->holding) {
+		a->interval *= 2;
+		if (a->interval > a->ceiling)
+			a->interval = a->ceiling;
+	}
+
+	a->moving = false;
+	a->holding = false;
+
+	return a->interval;
+}
@@ -0,0 +1,73 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_ADAPTIVE_H_
+#define RF_ADAPTIVE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ADAPTIVE_MAX_CHANNELS 8
+
+typedef struct adaptive_channel {
+	int32_t threshold; //!< Significant change per sample (0 to ignore)
+	int32_t last;
+	bool valid;
+} adaptive_channel_t;
+
+/*!
+ * \brief Adaptive sample interval tracker.
+ *
+ * The interval drops straight to the floor when any channel moves by more
+ * than its threshold between samples and doubles, up to the ceiling, when
+ * all channels are stable. It is held if the change seen over the last
+ * interval, continued for the doubled interval, would cross a threshold.
+ *
+ * All times are in microseconds.
+ */
+typedef struct adaptive {
+	uint64_t floor;
+	uint64_t ceiling;
+	uint64_t interval;
+
+	bool moving;
+	bool holding;
+
+	adaptive_channel_t channel[ADAPTIVE_MAX_CHANNELS];
+} adaptive_t;
+
+void adaptive_init(adaptive_t *a, uint64_t min_interval,
+		   uint64_t max_interval);
+void adaptive_set_threshold(adaptive_t *a, unsigned int ch,
+			    int32_t threshold);
+
+/*!
+ * \brief Record a new reading for a channel.
+ *
+ * Must be called once per channel per sample, before
+ * adaptive_next_interval().
+ */
+void adaptive_update(adaptive_t *a, unsigned int ch, int32_t value);
+
+/*!
+ * \brief Calculate the interval to wait before taking the next sample.
+ */
+uint64_t adaptive_next_interval(adaptive_t *a);
+
+#endif // RF_ADAPTIVE_H_
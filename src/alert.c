@@ -0,0 +1,49 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "alert.h"
+
+#include <string.h>
+
+void alert_reset(alert_t *a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+bool alert_update(alert_t *a, const alert_rule_t *r, int32_t value,
+		  uint64_t now)
+{
+	bool flip;
+
+	if (!a->active)
+		flip = r->low ? value < r->limit : value > r->limit;
+	else if (r->low)
+		flip = value >= r->limit + r->hysteresis;
+	else
+		flip = value <= r->limit - r->hysteresis;
+
+	if (!flip) {
+		a->pending = false;
+		return false;
+	}
+
+	if (!a->pending) {
+		a->pending = true;
+		a->since = now;
+	}
+
+	if (now - a->since < r->holdoff)
+		return false;
+
+	a->active = !a->active;
+	a->pending = false;
+	return true;
+}
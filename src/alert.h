@@ -0,0 +1,57 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_ALERT_H_
+#define RF_ALERT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*!
+ * \brief Threshold rule.
+ *
+ * A high rule is raised when the value rises above limit and cleared when
+ * it falls to limit - hysteresis or below (a low rule is the mirror
+ * image). The condition must hold continuously for holdoff microseconds
+ * before either transition takes effect.
+ */
+typedef struct alert_rule {
+	int32_t limit;
+	int32_t hysteresis;
+	uint64_t holdoff;
+	bool low; //!< Alert when the value is below (rather than above) limit
+} alert_rule_t;
+
+typedef struct alert {
+	bool active;
+	bool pending;   //!< Opposite condition seen, waiting for hold-off
+	uint64_t since; //!< Time the pending condition was first seen
+} alert_t;
+
+void alert_reset(alert_t *a);
+
+/*!
+ * \brief Evaluate a rule against a new reading.
+ *
+ * \returns true if the alert changed state (a->active holds the new state)
+ */
+bool alert_update(alert_t *a, const alert_rule_t *r, int32_t value,
+		  uint64_t now);
+
+#endif // RF_ALERT_H_
@@ -0,0 +1,272 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "bme280.h"
+
+#include <stdio.h>
+
+#include <librfn.h>
+
+#include "probe.h"
+
+static const uint8_t calibration_base[] = { 0x88 };
+static const uint8_t humidity_calibration_base[] = { 0xe1 };
+static const uint8_t out_base[] = { 0xf7 };
+
+#define REG_CHIP_ID 0xd0
+#define REG_RESET 0xe0
+#define REG_CTRL_HUM 0xf2
+#define REG_CTRL_MEAS 0xf4
+#define REG_CONFIG 0xf5
+
+#define CHIP_ID_BME280 0x60
+#define CHIP_ID_BMP280 0x58
+
+#define MODE_NORMAL 3
+
+static const uint8_t cached_regs[] = { REG_CHIP_ID };
+
+static void bme280_bist(bme280_t *s)
+{
+	int32_t raw_temp = 519888;
+	int32_t raw_pressure = 415148;
+
+	s->dig_t1 = 27504;
+	s->dig_t2 = 26435;
+	s->dig_t3 = -1000;
+	s->dig_p1 = 36477;
+	s->dig_p2 = -10685;
+	s->dig_p3 = 3024;
+	s->dig_p4 = 2855;
+	s->dig_p5 = 140;
+	s->dig_p6 = -7;
+	s->dig_p7 = 15500;
+	s->dig_p8 = -14600;
+	s->dig_p9 = 6000;
+
+	int32_t t = bme280_get_temp(s, raw_temp);
+	printf("T = %d\n", t);
+
+	int32_t p = bme280_get_pressure(s, raw_pressure);
+	printf("p = %d\n", p);
+}
+
+static uint16_t get16le(uint8_t *p)
+{
+	return p[0] + (p[1] << 8);
+}
+
+static int32_t get20(uint8_t *p)
+{
+	return (p[0] << 12) + (p[1] << 4) + (p[2] >> 4);
+}
+
+/*
+ * Maximum measurement time, in microseconds, for the configured
+ * oversampling (from the datasheet's measurement time formula).
+ */
+static unsigned int measurement_time(bme280_t *s)
+{
+	unsigned int t = 1250;
+
+	if (s->osrs_t)
+		t += 2300 << (s->osrs_t - 1);
+	if (s->osrs_p)
+		t += (2300 << (s->osrs_p - 1)) + 575;
+	if (s->osrs_h && s->has_humidity)
+		t += (2300 << (s->osrs_h - 1)) + 575;
+
+	return t;
+}
+
+pt_state_t bme280_init(bme280_t *s, uint32_t pi2c)
+{
+	uint8_t val;
+
+	PT_BEGIN(&s->pt);
+
+#if 0
+	bme280_bist(s);
+#else
+	(void) bme280_bist;
+#endif
+
+	if (!s->addr)
+		s->addr = 0x76;
+	if (!s->cache.entry) {
+		i2c_regcache_init(&s->cache, s->addr, s->cache_entry,
+				  cached_regs, lengthof(cached_regs));
+		i2c_regcache_set_readonly(&s->cache, REG_CHIP_ID);
+	}
+
+	i2c_ctx_init(&s->i2c, pi2c);
+	i2c_ctx_regcache_attach(&s->i2c, &s->cache);
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_getreg(&s->i2c, s->addr, REG_CHIP_ID, &val));
+	if (val != CHIP_ID_BME280 && val != CHIP_ID_BMP280)
+		PT_FAIL();
+	s->has_humidity = (val == CHIP_ID_BME280);
+
+	/* soft reset puts the device into sleep mode with default config */
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_setreg(&s->i2c, s->addr, REG_RESET, 0xb6));
+	i2c_ctx_regcache_invalidate(&s->i2c, s->addr);
+	i2c_ctx_usleep(2000);
+
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_write_read(&s->i2c, s->addr, calibration_base,
+					      sizeof(calibration_base),
+					      s->reply, 26));
+
+	s->dig_t1 = get16le(s->reply + 0);
+	s->dig_t2 = get16le(s->reply + 2);
+	s->dig_t3 = get16le(s->reply + 4);
+	s->dig_p1 = get16le(s->reply + 6);
+	s->dig_p2 = get16le(s->reply + 8);
+	s->dig_p3 = get16le(s->reply + 10);
+	s->dig_p4 = get16le(s->reply + 12);
+	s->dig_p5 = get16le(s->reply + 14);
+	s->dig_p6 = get16le(s->reply + 16);
+	s->dig_p7 = get16le(s->reply + 18);
+	s->dig_p8 = get16le(s->reply + 20);
+	s->dig_p9 = get16le(s->reply + 22);
+	s->dig_h1 = s->reply[25];
+
+	if (s->has_humidity) {
+		PT_SPAWN_AND_CHECK(
+		    &s->i2c.pt,
+		    i2c_ctx_write_read(&s->i2c, s->addr,
+				       humidity_calibration_base,
+				       sizeof(humidity_calibration_base),
+				       s->reply, 7));
+
+		s->dig_h2 = get16le(s->reply + 0);
+		s->dig_h3 = s->reply[2];
+		s->dig_h4 = ((int8_t) s->reply[3] * 16) | (s->reply[4] & 0x0f);
+		s->dig_h5 = ((int8_t) s->reply[5] * 16) | (s->reply[4] >> 4);
+		s->dig_h6 = s->reply[6];
+
+		/* ctrl_hum only takes effect after ctrl_meas is written */
+		PT_SPAWN_AND_CHECK(&s->i2c.pt,
+				   i2c_ctx_setreg(&s->i2c, s->addr,
+						  REG_CTRL_HUM, s->osrs_h));
+	}
+
+	/* config must be written before leaving sleep mode */
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_setreg(&s->i2c, s->addr, REG_CONFIG,
+					  (s->t_sb << 5) | (s->filter << 2)));
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_setreg(&s->i2c, s->addr, REG_CTRL_MEAS,
+					  (s->osrs_t << 5) | (s->osrs_p << 2) |
+					      MODE_NORMAL));
+
+	/* wait for the first conversion to complete */
+	i2c_ctx_usleep(measurement_time(s));
+
+	PT_END();
+}
+
+pt_state_t bme280_get_raw(bme280_t *s, int32_t *raw_temp,
+			  int32_t *raw_pressure, int32_t *raw_rh)
+{
+	PT_BEGIN(&s->pt);
+	PROBE1(bme280_read__start, s->addr);
+
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_write_read(&s->i2c, s->addr, out_base,
+					      sizeof(out_base), s->reply,
+					      s->has_humidity ? 8 : 6));
+
+	*raw_pressure = get20(s->reply + 0);
+	*raw_temp = get20(s->reply + 3);
+	*raw_rh = s->has_humidity ? (s->reply[6] << 8) + s->reply[7] : 0;
+	PROBE4(bme280_read__done, s->addr, *raw_temp, *raw_pressure, *raw_rh);
+	PT_END();
+}
+
+int32_t bme280_get_temp(bme280_t *s, int32_t raw_temp)
+{
+	int32_t var1, var2, t;
+
+	var1 = ((((raw_temp >> 3) - ((int32_t) s->dig_t1 << 1))) *
+		((int32_t) s->dig_t2)) >>
+	       11;
+	var2 = (((((raw_temp >> 4) - ((int32_t) s->dig_t1)) *
+		  ((raw_temp >> 4) - ((int32_t) s->dig_t1))) >>
+		 12) *
+		((int32_t) s->dig_t3)) >>
+	       14;
+	s->t_fine = var1 + var2;
+
+	/* datasheet formula gives 0.01C; round to 0.1C */
+	t = (s->t_fine * 5 + 128) >> 8;
+	return (t < 0 ? t - 5 : t + 5) / 10;
+}
+
+int32_t bme280_get_pressure(bme280_t *s, int32_t raw_pressure)
+{
+	int32_t var1, var2;
+	uint32_t p;
+
+	var1 = (((int32_t) s->t_fine) >> 1) - (int32_t) 64000;
+	var2 = (((var1 >> 2) * (var1 >> 2)) >> 11) * ((int32_t) s->dig_p6);
+	var2 = var2 + ((var1 * ((int32_t) s->dig_p5)) << 1);
+	var2 = (var2 >> 2) + (((int32_t) s->dig_p4) << 16);
+	var1 = (((s->dig_p3 * (((var1 >> 2) * (var1 >> 2)) >> 13)) >> 3) +
+		((((int32_t) s->dig_p2) * var1) >> 1)) >>
+	       18;
+	var1 = ((((32768 + var1)) * ((int32_t) s->dig_p1)) >> 15);
+	if (var1 == 0)
+		return 0; /* avoid division by zero */
+
+	p = (((uint32_t)(((int32_t) 1048576) - raw_pressure) - (var2 >> 12))) *
+	    3125;
+	if (p < 0x80000000)
+		p = (p << 1) / ((uint32_t) var1);
+	else
+		p = (p / (uint32_t) var1) * 2;
+	var1 = (((int32_t) s->dig_p9) *
+		((int32_t)(((p >> 3) * (p >> 3)) >> 13))) >>
+	       12;
+	var2 = (((int32_t)(p >> 2)) * ((int32_t) s->dig_p8)) >> 13;
+	p = (uint32_t)((int32_t) p + ((var1 + var2 + s->dig_p7) >> 4));
+
+	return p;
+}
+
+int bme280_get_humidity(bme280_t *s, int32_t raw_rh)
+{
+	int32_t v;
+
+	if (!s->has_humidity)
+		return 0;
+
+	v = (s->t_fine - ((int32_t) 76800));
+	v = (((((raw_rh << 14) - (((int32_t) s->dig_h4) << 20) -
+		(((int32_t) s->dig_h5) * v)) +
+	       ((int32_t) 16384)) >>
+	      15) *
+	     (((((((v * ((int32_t) s->dig_h6)) >> 10) *
+		  (((v * ((int32_t) s->dig_h3)) >> 11) + ((int32_t) 32768))) >>
+		 10) +
+		((int32_t) 2097152)) *
+		   ((int32_t) s->dig_h2) +
+	       8192) >>
+	      14));
+	v = (v - (((((v >> 15) * (v >> 15)) >> 7) * ((int32_t) s->dig_h1)) >>
+		  4));
+	v = (v < 0 ? 0 : v);
+	v = (v > 419430400 ? 419430400 : v);
+
+	/* v is now Q22.10 %RH (with 12 extra fractional bits) */
+	return ((v >> 12) + 512) >> 10;
+}
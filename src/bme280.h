@@ -0,0 +1,130 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_BME280_H_
+#define RF_BME280_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <librfn/protothreads.h>
+
+#include "i2c_ctx.h"
+
+/* Oversampling codes (osrs_t, osrs_p and osrs_h) */
+#define BME280_OSRS_SKIP 0
+#define BME280_OSRS_X1 1
+#define BME280_OSRS_X2 2
+#define BME280_OSRS_X4 3
+#define BME280_OSRS_X8 4
+#define BME280_OSRS_X16 5
+
+/* IIR filter codes */
+#define BME280_FILTER_OFF 0
+#define BME280_FILTER_2 1
+#define BME280_FILTER_4 2
+#define BME280_FILTER_8 3
+#define BME280_FILTER_16 4
+
+/* Standby codes (the 10ms/20ms codes are 2s/4s on a BMP280) */
+#define BME280_STANDBY_0_5MS 0
+#define BME280_STANDBY_62_5MS 1
+#define BME280_STANDBY_125MS 2
+#define BME280_STANDBY_250MS 3
+#define BME280_STANDBY_500MS 4
+#define BME280_STANDBY_1000MS 5
+#define BME280_STANDBY_10MS 6
+#define BME280_STANDBY_20MS 7
+
+/*!
+ * \brief BME280/BMP280 driver state.
+ *
+ * The device is run in normal mode so, once bme280_init() has completed,
+ * the hardware converts continuously and each reading is a single burst
+ * read with no trigger.
+ *
+ * addr and the oversampling, filter and standby fields must be set by
+ * the caller before calling bme280_init(). Setting an oversampling code
+ * to BME280_OSRS_SKIP disables that measurement. If addr is zero then
+ * 0x76 is used.
+ */
+typedef struct bme280 {
+	pt_t pt;      //!< Protothread state
+	i2c_ctx_t i2c;
+	i2c_regcache_t cache;
+	i2c_regcache_entry_t cache_entry[1];
+
+	uint8_t reply[26];
+
+	uint8_t addr;
+	uint8_t osrs_t;
+	uint8_t osrs_p;
+	uint8_t osrs_h;
+	uint8_t filter;
+	uint8_t t_sb;
+
+	bool has_humidity; //!< False for a BMP280
+
+	uint16_t dig_t1;
+	int16_t dig_t2;
+	int16_t dig_t3;
+	uint16_t dig_p1;
+	int16_t dig_p2;
+	int16_t dig_p3;
+	int16_t dig_p4;
+	int16_t dig_p5;
+	int16_t dig_p6;
+	int16_t dig_p7;
+	int16_t dig_p8;
+	int16_t dig_p9;
+	uint8_t dig_h1;
+	int16_t dig_h2;
+	uint8_t dig_h3;
+	int16_t dig_h4;
+	int16_t dig_h5;
+	int8_t dig_h6;
+
+	int32_t t_fine;
+} bme280_t;
+
+pt_state_t bme280_init(bme280_t *s, uint32_t pi2c);
+
+/*!
+ * \brief Fetch the most recent conversion results.
+ *
+ * Temperature, pressure and (on a BME280) humidity are read with a single
+ * burst read. raw_rh is set to zero on a BMP280.
+ */
+pt_state_t bme280_get_raw(bme280_t *s, int32_t *raw_temp,
+			  int32_t *raw_pressure, int32_t *raw_rh);
+
+/*!
+ * \brief Calculate temperature in units of 0.1C.
+ *
+ * Must be called before bme280_get_pressure() or bme280_get_humidity()
+ * because it updates the t_fine value they depend upon.
+ */
+int32_t bme280_get_temp(bme280_t *s, int32_t raw_temp);
+
+//! Calculate pressure in Pa.
+int32_t bme280_get_pressure(bme280_t *s, int32_t raw_pressure);
+
+//! Calculate relative humidity in percent.
+int bme280_get_humidity(bme280_t *s, int32_t raw_rh);
+
+#endif // RF_BME280_H_
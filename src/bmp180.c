@@ -12,12 +12,18 @@
 #include "bmp180.h"
 
 #include <stdio.h>
-#include <unistd.h>
+
+#include <librfn.h>
+
+#include "probe.h"
 
 const uint8_t calibration_base[] = { 0xaa };
 const uint8_t ctrl_meas[] = { 0xf4 };
 const uint8_t out_base[] = { 0xf6 };
 
+/* chip ID and calibration registers are read-only */
+static const uint8_t cached_regs[] = { 0xd0, 0xaa };
+
 static void bmp180_bist(bmp180_t *s)
 {
 	uint16_t raw_temp = 27898;
@@ -59,7 +65,15 @@ pt_state_t bmp180_init(bmp180_t *s, uint32_t pi2c)
 	(void) bmp180_bist;
 #endif
 
+	if (!s->cache.entry) {
+		i2c_regcache_init(&s->cache, 0x77, s->cache_entry, cached_regs,
+				  lengthof(cached_regs));
+		for (unsigned int i = 0; i < lengthof(cached_regs); i++)
+			i2c_regcache_set_readonly(&s->cache, cached_regs[i]);
+	}
+
 	i2c_ctx_init(&s->i2c, pi2c);
+	i2c_ctx_regcache_attach(&s->i2c, &s->cache);
 	PT_SPAWN_AND_CHECK(&s->i2c.pt,
 			   i2c_ctx_getreg(&s->i2c, 0x77, 0xd0, &val));
 	if (val != 0x55)
@@ -75,6 +89,7 @@ pt_state_t bmp180_init(bmp180_t *s, uint32_t pi2c)
 					      sizeof(s->reply)));
 
 	s->oss = 0;
+	s->temp_valid = false;
 
 	/* interpret the reply */
 	s->ac1 = get16(s->reply + 0);
@@ -93,30 +108,111 @@ pt_state_t bmp180_init(bmp180_t *s, uint32_t pi2c)
 	PT_END();
 }
 
+void bmp180_set_temp_refresh(bmp180_t *s, uint64_t usecs)
+{
+	s->temp_refresh = usecs;
+}
+
+void bmp180_invalidate_temp(bmp180_t *s)
+{
+	s->temp_valid = false;
+}
+
+static bool temp_cached(bmp180_t *s)
+{
+	return s->temp_refresh && s->temp_valid &&
+	       time_now() - s->temp_stamp < s->temp_refresh;
+}
+
 pt_state_t bmp180_get_raw_temp(bmp180_t *s, uint16_t *raw_temp)
 {
 	PT_BEGIN(&s->pt);
 
+	if (!temp_cached(s)) {
+		PROBE0(bmp180_temp__start);
+
+		PT_SPAWN_AND_CHECK(&s->i2c.pt,
+				   i2c_ctx_setreg(&s->i2c, 0x77, ctrl_meas[0],
+						  0x2e));
+		i2c_ctx_usleep(50000);
+
+		PT_SPAWN_AND_CHECK(&s->i2c.pt,
+				   i2c_ctx_write_read(&s->i2c, 0x77, out_base,
+						      sizeof(out_base),
+						      s->reply, 2));
+
+		s->raw_temp = get16(s->reply);
+		s->temp_stamp = time_now();
+		s->temp_valid = true;
+		PROBE1(bmp180_temp__done, s->raw_temp);
+	}
+
+	*raw_temp = s->raw_temp;
+	PT_END();
+}
+
+pt_state_t bmp180_get_raw_pressure(bmp180_t *s, uint32_t *raw_pressure)
+{
+	PT_BEGIN(&s->pt);
+	PROBE1(bmp180_pressure__start, s->oss);
+
+	PT_SPAWN_AND_CHECK(
+	    &s->i2c.pt,
+	    i2c_ctx_setreg(&s->i2c, 0x77, ctrl_meas[0], 0x34 + (s->oss << 6)));
+	i2c_ctx_usleep(50000);
+
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_write_read(&s->i2c, 0x77, out_base,
+					      sizeof(out_base), s->reply, 3));
+
+	*raw_pressure = (s->reply[0] << 16) + (s->reply[1] << 8) + s->reply[2];
+	*raw_pressure >>= 8 - s->oss;
+	PROBE1(bmp180_pressure__done, *raw_pressure);
+	PT_END();
+}
+
+pt_state_t bmp180_start_temp(bmp180_t *s)
+{
+	PT_BEGIN(&s->pt);
+	PROBE0(bmp180_temp__start);
+
 	PT_SPAWN_AND_CHECK(&s->i2c.pt,
 			   i2c_ctx_setreg(&s->i2c, 0x77, ctrl_meas[0], 0x2e));
-	usleep(50000);
+
+	PT_END();
+}
+
+pt_state_t bmp180_fetch_raw_temp(bmp180_t *s, uint16_t *raw_temp)
+{
+	PT_BEGIN(&s->pt);
 
 	PT_SPAWN_AND_CHECK(&s->i2c.pt,
 			   i2c_ctx_write_read(&s->i2c, 0x77, out_base,
 					      sizeof(out_base), s->reply, 2));
 
-	*raw_temp = get16(s->reply);
+	s->raw_temp = get16(s->reply);
+	s->temp_stamp = time_now();
+	s->temp_valid = true;
+	*raw_temp = s->raw_temp;
+	PROBE1(bmp180_temp__done, s->raw_temp);
 	PT_END();
 }
 
-pt_state_t bmp180_get_raw_pressure(bmp180_t *s, uint32_t *raw_pressure)
+pt_state_t bmp180_start_pressure(bmp180_t *s)
 {
 	PT_BEGIN(&s->pt);
+	PROBE1(bmp180_pressure__start, s->oss);
 
 	PT_SPAWN_AND_CHECK(
 	    &s->i2c.pt,
 	    i2c_ctx_setreg(&s->i2c, 0x77, ctrl_meas[0], 0x34 + (s->oss << 6)));
-	usleep(50000);
+
+	PT_END();
+}
+
+pt_state_t bmp180_fetch_raw_pressure(bmp180_t *s, uint32_t *raw_pressure)
+{
+	PT_BEGIN(&s->pt);
 
 	PT_SPAWN_AND_CHECK(&s->i2c.pt,
 			   i2c_ctx_write_read(&s->i2c, 0x77, out_base,
@@ -124,9 +220,18 @@ pt_state_t bmp180_get_raw_pressure(bmp180_t *s, uint32_t *raw_pressure)
 
 	*raw_pressure = (s->reply[0] << 16) + (s->reply[1] << 8) + s->reply[2];
 	*raw_pressure >>= 8 - s->oss;
+	PROBE1(bmp180_pressure__done, *raw_pressure);
 	PT_END();
 }
 
+uint32_t bmp180_conversion_time(bmp180_t *s, bool pressure)
+{
+	/* maximum conversion times (us) from the datasheet */
+	static const uint32_t oss_time[] = { 4500, 7500, 13500, 25500 };
+
+	return pressure ? oss_time[s->oss & 3] : 4500;
+}
+
 int32_t bmp180_get_temp(bmp180_t *s, uint16_t raw_temp)
 {
 	int32_t x1, x2;
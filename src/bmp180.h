@@ -29,6 +29,8 @@
 typedef struct bmp180 {
 	pt_t pt;      //!< Protothread state
 	i2c_ctx_t i2c;
+	i2c_regcache_t cache;
+	i2c_regcache_entry_t cache_entry[2];
 
 	uint8_t reply[22];
 
@@ -47,12 +49,48 @@ typedef struct bmp180 {
 	int16_t md;
 
 	int32_t b5;
+
+	uint64_t temp_refresh; //!< Temperature cache lifetime (us), 0 disables
+	uint64_t temp_stamp;   //!< Time of the last temperature conversion
+	uint16_t raw_temp;     //!< Cached raw temperature
+	bool temp_valid;
 } bmp180_t;
 
 pt_state_t bmp180_init(bmp180_t *s, uint32_t pi2c);
+
+/*!
+ * \brief Set how long a temperature reading may be reused.
+ *
+ * Pressure compensation only needs the b5 term derived from temperature,
+ * and temperature drifts far more slowly than pressure. With a non-zero
+ * refresh interval bmp180_get_raw_temp() returns the cached reading,
+ * without touching the bus, until the interval expires or
+ * bmp180_invalidate_temp() is called.
+ */
+void bmp180_set_temp_refresh(bmp180_t *s, uint64_t usecs);
+
+//! Force the next bmp180_get_raw_temp() to run a conversion.
+void bmp180_invalidate_temp(bmp180_t *s);
+
 pt_state_t bmp180_get_raw_temp(bmp180_t *s, uint16_t *raw_temp);
 int32_t bmp180_get_temp(bmp180_t *s, uint16_t raw_temp);
 pt_state_t bmp180_get_raw_pressure(bmp180_t *s, uint32_t *raw_pressure);
 int32_t bmp180_get_pressure(bmp180_t *s, uint32_t raw_pressure);
 
+/*!
+ * \brief Split conversions.
+ *
+ * These allow the caller to do other work on the bus while a conversion
+ * runs; the result may be fetched once bmp180_conversion_time() has
+ * elapsed. Only one conversion can be in flight at a time. Fetching a
+ * temperature also refreshes the cache used by bmp180_get_raw_temp().
+ */
+pt_state_t bmp180_start_temp(bmp180_t *s);
+pt_state_t bmp180_fetch_raw_temp(bmp180_t *s, uint16_t *raw_temp);
+pt_state_t bmp180_start_pressure(bmp180_t *s);
+pt_state_t bmp180_fetch_raw_pressure(bmp180_t *s, uint32_t *raw_pressure);
+
+//! Worst case conversion time (us) at the configured oversampling.
+uint32_t bmp180_conversion_time(bmp180_t *s, bool pressure);
+
 #endif // RF_BMP180_H_
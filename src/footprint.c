@@ -0,0 +1,36 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Report the RAM consumed by each driver's state. Run by "make footprint"
+ * alongside size(1) on the driver objects to report flash usage.
+ */
+
+#include <stdio.h>
+
+#include "bme280.h"
+#include "bmp180.h"
+#include "i2c_ctx.h"
+#include "si7021.h"
+
+#define REPORT(type) printf("%-12s %5zu\n", #type, sizeof(type))
+
+int main(void)
+{
+	printf("%-12s %5s\n", "type", "bytes");
+	REPORT(i2c_ctx_t);
+	REPORT(i2c_bus_t);
+	REPORT(bme280_t);
+	REPORT(bmp180_t);
+	REPORT(si7021_t);
+
+	return 0;
+}
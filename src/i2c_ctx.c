@@ -24,6 +24,7 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -33,37 +34,276 @@
 
 #include <librfn.h>
 
-static int fd = -1;
-static int current_pi2c = -1;
+#include "probe.h"
+#include "vclock.h"
+
+/*
+ * The table, the register caches and the trace file are shared by every
+ * thread and are protected by the lock. Each bus's transfer buffers are
+ * protected by its lease (see i2c_bus_t).
+ */
+static i2c_bus_t buses[I2C_CTX_MAX_BUSES];
+static unsigned int num_buses;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Trace file layout (native endian, intended for replay on the machine
+ * that captured it or one of the same architecture):
+ *
+ *   trace_header_t
+ *   for each transaction (buses interleaved in the order they ran):
+ *     trace_rdwr_t
+ *     for each message:
+ *       trace_msg_t
+ *       len bytes of payload (data written or data read)
+ */
+#define TRACE_MAGIC "I2CTRACE"
+#define TRACE_VERSION 2
+
+typedef struct trace_header {
+	char magic[8];
+	uint32_t version;
+} trace_header_t;
+
+typedef struct trace_rdwr {
+	uint64_t timestamp; //!< Start of transaction (time_now())
+	uint32_t duration;  //!< Duration of the ioctl (us)
+	int32_t res;
+	int32_t err;
+	uint32_t nmsgs;
+	uint32_t pi2c;      //!< Bus the transaction was issued on
+} trace_rdwr_t;
+
+typedef struct trace_msg {
+	uint16_t addr;
+	uint16_t flags;
+	uint16_t len;
+} trace_msg_t;
+
+static FILE *trace;
+static FILE *replay;
+static unsigned int replay_count;
+static unsigned int replay_mismatches;
+static uint64_t replay_start;
+
+/*
+ * During replay each bus consumes only its own records. Records for other
+ * buses that are read while searching are held here, in trace order,
+ * until their bus asks for them.
+ */
+typedef struct replay_rec {
+	struct replay_rec *next;
+	trace_rdwr_t t;
+	uint8_t data[]; //!< trace_msg_t and payload for each message
+} replay_rec_t;
+
+static replay_rec_t *replay_pending;
+static replay_rec_t **replay_pending_tail = &replay_pending;
+static i2c_ctx_transport_t *transport;
+
+static void open_bus(i2c_bus_t *bus, uint32_t pi2c)
+{
+	bus->pi2c = pi2c;
+	atomic_init(&bus->owner, NULL);
+	bus->caches = NULL;
+	bus->fd = -1;
+}
+
+/*
+ * The device is opened by the first transaction that needs the hardware
+ * so that buses first used during a replay, or with a simulated transport,
+ * work once it stops. Must be called with the bus leased.
+ */
+static int bus_fd(i2c_bus_t *bus)
+{
+	if (bus->fd >= 0)
+		return bus->fd;
+
+	char *fname = xstrdup_printf("/dev/i2c-%d", bus->pi2c);
+	bus->fd = open(fname, O_RDWR);
+	int err = errno;
+
+	if (bus->fd < 0)
+		fprintf(stderr, "Cannot open %s: %s\n", fname, strerror(err));
+	free(fname);
+	errno = err;
+
+	return bus->fd;
+}
+
+void i2c_regcache_init(i2c_regcache_t *rc, uint16_t addr,
+		       i2c_regcache_entry_t *entry, const uint8_t *regs,
+		       uint8_t num_regs)
+{
+	rc->next = NULL;
+	rc->addr = addr;
+	rc->bus = -1;
+	rc->num_entries = num_regs;
+	rc->entry = entry;
+
+	for (unsigned int i = 0; i < num_regs; i++) {
+		entry[i].reg = regs[i];
+		entry[i].valid = false;
+		entry[i].readonly = false;
+	}
+}
+
+void i2c_regcache_set_readonly(i2c_regcache_t *rc, uint8_t reg)
+{
+	for (unsigned int i = 0; i < rc->num_entries; i++)
+		if (rc->entry[i].reg == reg)
+			rc->entry[i].readonly = true;
+}
+
+void i2c_ctx_regcache_attach(i2c_ctx_t *c, i2c_regcache_t *rc)
+{
+	i2c_regcache_t **p;
+
+	if (c->bus == I2C_CTX_NO_BUS)
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (rc->bus == c->bus) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	/* unlink from the old bus (if any) */
+	if (rc->bus >= 0) {
+		for (p = &buses[rc->bus].caches; *p; p = &(*p)->next) {
+			if (*p == rc) {
+				*p = rc->next;
+				break;
+			}
+		}
+		for (unsigned int i = 0; i < rc->num_entries; i++)
+			rc->entry[i].valid = false;
+	}
+
+	rc->bus = c->bus;
+	rc->next = buses[c->bus].caches;
+	buses[c->bus].caches = rc;
+	pthread_mutex_unlock(&lock);
+}
+
+void i2c_ctx_regcache_invalidate(i2c_ctx_t *c, uint16_t addr)
+{
+	if (c->bus == I2C_CTX_NO_BUS)
+		return;
+
+	pthread_mutex_lock(&lock);
+	for (i2c_regcache_t *rc = buses[c->bus].caches; rc; rc = rc->next)
+		if (rc->addr == addr)
+			for (unsigned int i = 0; i < rc->num_entries; i++)
+				if (!rc->entry[i].readonly)
+					rc->entry[i].valid = false;
+	pthread_mutex_unlock(&lock);
+}
+
+//! Must be called with the lock held.
+static i2c_regcache_entry_t *regcache_lookup(i2c_ctx_t *c, uint16_t addr,
+					     uint16_t reg)
+{
+	if (c->bus == I2C_CTX_NO_BUS)
+		return NULL;
+
+	for (i2c_regcache_t *rc = buses[c->bus].caches; rc; rc = rc->next) {
+		if (rc->addr != addr)
+			continue;
+
+		for (unsigned int i = 0; i < rc->num_entries; i++)
+			if (rc->entry[i].reg == reg)
+				return &rc->entry[i];
+	}
+
+	return NULL;
+}
+
+static bool regcache_read(i2c_ctx_t *c, uint16_t addr, uint16_t reg,
+			  uint8_t *val)
+{
+	i2c_regcache_entry_t *e;
+	bool hit;
+
+	pthread_mutex_lock(&lock);
+	e = regcache_lookup(c, addr, reg);
+	hit = e && e->valid;
+	if (hit)
+		*val = e->val;
+	pthread_mutex_unlock(&lock);
+
+	return hit;
+}
+
+static void regcache_write(i2c_ctx_t *c, uint16_t addr, uint16_t reg,
+			   uint8_t val, bool valid)
+{
+	i2c_regcache_entry_t *e;
+
+	pthread_mutex_lock(&lock);
+	e = regcache_lookup(c, addr, reg);
+	if (e) {
+		e->val = val;
+		e->valid = valid;
+	}
+	pthread_mutex_unlock(&lock);
+}
 
 void i2c_ctx_init(i2c_ctx_t *c, uint32_t pi2c)
 {
-	/* update the file descriptor */
-	if (current_pi2c != pi2c) {
-		current_pi2c = pi2c;
-		if (fd >= 0)
-			close(fd);
+	unsigned int i;
 
-		char *fname = xstrdup_printf("/dev/i2c-%d", pi2c);
-		fd = open(fname, O_RDWR);
-		free(fname);
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < num_buses; i++)
+		if (buses[i].pi2c == pi2c)
+			break;
 
-		if (fd < 0)
-			fprintf(stderr, "Cannot open I2C device: %s\n",
-				strerror(errno));
+	/*
+	 * Contexts keep their bus index for as long as they live so a slot
+	 * can never be reused for a different bus.
+	 */
+	if (i == num_buses) {
+		if (num_buses < lengthof(buses)) {
+			num_buses++;
+			open_bus(&buses[i], pi2c);
+		} else {
+			fprintf(stderr, "Too many I2C buses\n");
+			i = I2C_CTX_NO_BUS;
+		}
 	}
+	pthread_mutex_unlock(&lock);
 
+	c->bus = i;
 	i2c_ctx_reset(c);
 }
 
 void i2c_ctx_reset(i2c_ctx_t *c)
 {
+	i2c_ctx_t *owner = c;
+
 	c->msg_index = -1;
+	if (c->bus != I2C_CTX_NO_BUS)
+		atomic_compare_exchange_strong(&buses[c->bus].owner, &owner,
+					       NULL);
+}
+
+//! Take the bus lease (or confirm we already hold it).
+static bool bus_lease(i2c_bus_t *bus, i2c_ctx_t *c)
+{
+	i2c_ctx_t *owner = NULL;
+
+	return atomic_compare_exchange_strong(&bus->owner, &owner, c) ||
+	       owner == c;
 }
 
 pt_state_t i2c_ctx_start(i2c_ctx_t *c)
 {
+	i2c_bus_t *bus = c->bus == I2C_CTX_NO_BUS ? NULL : &buses[c->bus];
+
 	PT_BEGIN(&c->leaf);
+	PT_FAIL_ON(!bus);
+	if (c->msg_index < 0)
+		PT_WAIT_UNTIL(bus_lease(bus, c));
 	c->msg_index++;
 	PT_END();
 }
@@ -73,11 +313,12 @@ pt_state_t i2c_ctx_sendaddr(i2c_ctx_t *c, uint16_t addr,
 {
 	PT_BEGIN(&c->leaf);
 
-	struct i2c_msg *m = &c->msgs[c->msg_index];
+	i2c_bus_t *bus = &buses[c->bus];
+	struct i2c_msg *m = &bus->msgs[c->msg_index];
 	m->addr = addr;
 	m->flags = bytes_to_read ? I2C_M_RD : 0;
 	m->len = bytes_to_read;
-	m->buf = c->buf + 32 * c->msg_index;
+	m->buf = bus->buf + 32 * c->msg_index;
 	
 	c->bytes_read = 0;
 
@@ -88,18 +329,174 @@ pt_state_t i2c_ctx_senddata(i2c_ctx_t *c, uint8_t data)
 {
 	PT_BEGIN(&c->leaf);
 
-	struct i2c_msg *m = &c->msgs[c->msg_index];
+	struct i2c_msg *m = &buses[c->bus].msgs[c->msg_index];
 	m->buf[m->len++] = data;
 
 
 	PT_END();
 }
 
+static void trace_rdwr(uint32_t pi2c, struct i2c_rdwr_ioctl_data *rdwr,
+		       int res, int err, uint64_t start, uint64_t end)
+{
+	trace_rdwr_t t = { .timestamp = start,
+			   .duration = end - start,
+			   .res = res,
+			   .err = res < 0 ? err : 0,
+			   .nmsgs = rdwr->nmsgs,
+			   .pi2c = pi2c };
+
+	fwrite(&t, sizeof(t), 1, trace);
+	for (unsigned int i = 0; i < rdwr->nmsgs; i++) {
+		struct i2c_msg *m = &rdwr->msgs[i];
+		trace_msg_t tm = {
+		    .addr = m->addr, .flags = m->flags, .len = m->len
+		};
+
+		fwrite(&tm, sizeof(tm), 1, trace);
+		fwrite(m->buf, 1, m->len, trace);
+	}
+
+	/* make sure we keep the trace if the bus (or the process) dies */
+	fflush(trace);
+}
+
+static replay_rec_t *replay_read(void)
+{
+	uint8_t data[4 * (sizeof(trace_msg_t) + UINT8_MAX + 1)];
+	replay_rec_t *rec;
+	trace_rdwr_t t;
+	size_t len = 0;
+
+	if (1 != fread(&t, sizeof(t), 1, replay)) {
+		errno = ENODATA;
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < t.nmsgs; i++) {
+		trace_msg_t tm;
+
+		if (i >= 4 || 1 != fread(&tm, sizeof(tm), 1, replay) ||
+		    tm.len > UINT8_MAX + 1 ||
+		    tm.len != fread(data + len + sizeof(tm), 1, tm.len,
+				    replay)) {
+			fprintf(stderr, "Replay trace is truncated\n");
+			errno = EIO;
+			return NULL;
+		}
+
+		memcpy(data + len, &tm, sizeof(tm));
+		len += sizeof(tm) + tm.len;
+	}
+
+	rec = xmalloc(sizeof(*rec) + len);
+	rec->next = NULL;
+	rec->t = t;
+	memcpy(rec->data, data, len);
+	return rec;
+}
+
+static replay_rec_t *replay_next(uint32_t pi2c)
+{
+	replay_rec_t **p, *rec;
+
+	for (p = &replay_pending; *p; p = &(*p)->next) {
+		if ((*p)->t.pi2c != pi2c)
+			continue;
+
+		rec = *p;
+		*p = rec->next;
+		if (replay_pending_tail == &rec->next)
+			replay_pending_tail = p;
+		return rec;
+	}
+
+	while ((rec = replay_read())) {
+		if (rec->t.pi2c == pi2c)
+			return rec;
+
+		*replay_pending_tail = rec;
+		replay_pending_tail = &rec->next;
+	}
+
+	return NULL;
+}
+
+static void replay_free_pending(void)
+{
+	while (replay_pending) {
+		replay_rec_t *rec = replay_pending;
+
+		replay_pending = rec->next;
+		free(rec);
+	}
+	replay_pending_tail = &replay_pending;
+}
+
+static int replay_rdwr(uint32_t pi2c, struct i2c_rdwr_ioctl_data *rdwr)
+{
+	replay_rec_t *rec = replay_next(pi2c);
+	bool mismatch = false;
+	uint8_t *p;
+	int res;
+
+	if (!rec) {
+		if (errno == ENODATA) {
+			fprintf(stderr, "Replay trace exhausted for bus %u "
+					"after %u transactions\n",
+				pi2c, replay_count);
+			errno = ENODATA;
+		}
+		return -1;
+	}
+	replay_count++;
+
+	if (rec->t.nmsgs != rdwr->nmsgs)
+		mismatch = true;
+
+	p = rec->data;
+	for (unsigned int i = 0; i < rec->t.nmsgs; i++) {
+		struct i2c_msg *m = i < rdwr->nmsgs ? &rdwr->msgs[i] : NULL;
+		uint8_t *payload = p + sizeof(trace_msg_t);
+		trace_msg_t tm;
+
+		/* records are packed so the header may be unaligned */
+		memcpy(&tm, p, sizeof(tm));
+		p = payload + tm.len;
+
+		if (!m || m->addr != tm.addr || m->flags != tm.flags ||
+		    m->len != tm.len) {
+			mismatch = true;
+			continue;
+		}
+
+		if (m->flags & I2C_M_RD)
+			memcpy(m->buf, payload, tm.len);
+		else if (0 != memcmp(m->buf, payload, tm.len))
+			mismatch = true;
+	}
+
+	if (mismatch) {
+		replay_mismatches++;
+		fprintf(stderr, "Replay diverged from trace at transaction %u\n",
+			replay_count);
+	}
+
+	res = rec->t.res;
+	errno = rec->t.err;
+	free(rec);
+	return res;
+}
+
 static int do_rdwr(i2c_ctx_t *c)
 {
+	i2c_bus_t *bus = &buses[c->bus];
 	struct i2c_rdwr_ioctl_data rdwr;
-	rdwr.msgs = c->msgs;
+	rdwr.msgs = bus->msgs;
 	rdwr.nmsgs = c->msg_index + 1;
+	uint64_t start = 0;
+	bool replaying, tracing;
+	int res;
 
 #if 0
 	for (int i=0; i<rdwr.nmsgs; i++) {
@@ -110,7 +507,43 @@ static int do_rdwr(i2c_ctx_t *c)
 	}
 #endif
 
-	int res = ioctl(fd, I2C_RDWR, &rdwr);
+	PROBE3(rdwr__start, bus->pi2c, rdwr.msgs[0].addr, rdwr.nmsgs);
+
+	pthread_mutex_lock(&lock);
+	replaying = replay != NULL;
+	tracing = trace != NULL;
+	if (replaying)
+		res = replay_rdwr(bus->pi2c, &rdwr);
+	pthread_mutex_unlock(&lock);
+
+	if (!replaying) {
+		if (tracing)
+			start = time_now();
+		if (transport) {
+			pthread_mutex_lock(&lock);
+			res = transport(bus->pi2c, rdwr.msgs, rdwr.nmsgs);
+			pthread_mutex_unlock(&lock);
+		} else if (bus_fd(bus) < 0) {
+			res = -1;
+		} else {
+			res = ioctl(bus->fd, I2C_RDWR, &rdwr);
+		}
+		if (tracing) {
+			int err = errno;
+			uint64_t end = time_now();
+
+			/* the trace may have been closed while we ran */
+			pthread_mutex_lock(&lock);
+			if (trace)
+				trace_rdwr(bus->pi2c, &rdwr, res, err, start,
+					   end);
+			pthread_mutex_unlock(&lock);
+			errno = err;
+		}
+	}
+
+	PROBE4(rdwr__done, bus->pi2c, rdwr.msgs[0].addr, rdwr.nmsgs, res);
+
 	if (res == rdwr.nmsgs) {
 #if 0
 		if (0 != (rdwr.msgs[rdwr.nmsgs - 1].flags & I2C_M_RD))
@@ -136,14 +569,16 @@ static int do_rdwr(i2c_ctx_t *c)
 
 pt_state_t i2c_ctx_getdata(i2c_ctx_t *c, uint8_t *data)
 {
-	struct i2c_msg *m = &c->msgs[c->msg_index];
+	struct i2c_msg *m = &buses[c->bus].msgs[c->msg_index];
 
 	PT_BEGIN(&c->leaf);
 
 	PT_FAIL_ON(c->msg_index < 0);
-	PT_FAIL_ON(!(m->flags & I2C_M_RD));
+	if (!(m->flags & I2C_M_RD) || (!c->bytes_read && 0 != do_rdwr(c))) {
+		i2c_ctx_reset(c);
+		PT_FAIL();
+	}
 	if (!c->bytes_read) {
-		PT_FAIL_ON(0 != do_rdwr(c));
 		*data = m->buf[0];
 		c->bytes_read = 1;
 	} else {
@@ -159,14 +594,16 @@ pt_state_t i2c_ctx_getdata(i2c_ctx_t *c, uint8_t *data)
 pt_state_t i2c_ctx_stop(i2c_ctx_t *c)
 {
 	PT_BEGIN(&c->leaf);
-	PT_FAIL_ON(0 != do_rdwr(c));
+	int res = do_rdwr(c);
 	i2c_ctx_reset(c);
+	PT_FAIL_ON(0 != res);
 	PT_END();
 }
 
 pt_state_t i2c_ctx_detect(i2c_ctx_t *c, i2c_device_map_t *map)
 {
 	PT_BEGIN(&c->pt);
+	PROBE0(detect__start);
 
 	memset(map, 0, sizeof(*map));
 
@@ -186,6 +623,7 @@ pt_state_t i2c_ctx_detect(i2c_ctx_t *c, i2c_device_map_t *map)
 		map->devices[c->i / 16] |= 1 << (c->i % 16);
 	}
 
+	PROBE0(detect__done);
 	PT_END();
 }
 
@@ -193,6 +631,10 @@ pt_state_t i2c_ctx_setreg(i2c_ctx_t *c, uint16_t addr, uint16_t reg,
 				 uint8_t val)
 {
 	PT_BEGIN(&c->pt);
+	PROBE3(setreg__start, addr, reg, val);
+
+	/* if the write fails we no longer know the register's value */
+	regcache_write(c, addr, reg, val, false);
 
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_start(c));
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_sendaddr(c, addr, I2C_WRITE));
@@ -200,6 +642,9 @@ pt_state_t i2c_ctx_setreg(i2c_ctx_t *c, uint16_t addr, uint16_t reg,
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_senddata(c, val));
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_stop(c));
 
+	regcache_write(c, addr, reg, val, true);
+
+	PROBE2(setreg__done, addr, reg);
 	PT_END();
 }
 
@@ -207,18 +652,26 @@ pt_state_t i2c_ctx_getreg(i2c_ctx_t *c, uint16_t addr, uint16_t reg,
 				 uint8_t *val)
 {
 	PT_BEGIN(&c->pt);
+	PROBE2(getreg__start, addr, reg);
+
+	if (!regcache_read(c, addr, reg, val)) {
+		PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_start(c));
+		PT_SPAWN_AND_CHECK(&c->leaf,
+				   i2c_ctx_sendaddr(c, addr, I2C_WRITE));
+		PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_senddata(c, reg));
+		PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_start(c));
+		PT_SPAWN_AND_CHECK(&c->leaf,
+				   i2c_ctx_sendaddr(c, addr, I2C_READ));
+		PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_getdata(c, val));
+
+		/* For reads STOP is generated automatically by sendaddr
+		 * and/or getdata
+		 */
+
+		regcache_write(c, addr, reg, *val, true);
+	}
 
-	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_start(c));
-	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_sendaddr(c, addr, I2C_WRITE));
-	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_senddata(c, reg));
-	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_start(c));
-	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_sendaddr(c, addr, I2C_READ));
-	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_getdata(c, val));
-
-	/* For reads STOP is generated automatically by sendaddr and/or
-	 * getdata
-	 */
-
+	PROBE3(getreg__done, addr, reg, *val);
 	PT_END();
 }
 
@@ -226,6 +679,7 @@ pt_state_t i2c_ctx_write(i2c_ctx_t *c, uint16_t addr, const uint8_t *data,
 			 uint8_t len)
 {
 	PT_BEGIN(&c->pt);
+	PROBE2(write__start, addr, len);
 
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_start(c));
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_sendaddr(c, addr, I2C_WRITE));
@@ -236,6 +690,7 @@ pt_state_t i2c_ctx_write(i2c_ctx_t *c, uint16_t addr, const uint8_t *data,
 
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_stop(c));
 
+	PROBE2(write__done, addr, len);
 	PT_END();
 }
 
@@ -243,12 +698,14 @@ pt_state_t i2c_ctx_read(i2c_ctx_t *c, uint16_t addr, uint8_t *data,
 			uint8_t len)
 {
 	PT_BEGIN(&c->pt);
+	PROBE2(read__start, addr, len);
 
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_start(c));
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_sendaddr(c, addr, len));
 	for (c->i = 0; c->i < len; c->i++)
 		PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_getdata(c, data + c->i));
 
+	PROBE2(read__done, addr, len);
 	PT_END();
 }
 
@@ -256,6 +713,7 @@ pt_state_t i2c_ctx_write_read(i2c_ctx_t *c, uint16_t addr, const uint8_t *in,
 			      uint8_t in_len, uint8_t *out, uint8_t out_len)
 {
 	PT_BEGIN(&c->pt);
+	PROBE3(write_read__start, addr, in_len, out_len);
 
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_start(c));
 	PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_sendaddr(c, addr, I2C_WRITE));
@@ -267,5 +725,116 @@ pt_state_t i2c_ctx_write_read(i2c_ctx_t *c, uint16_t addr, const uint8_t *in,
 	for (c->i = 0; c->i < out_len; c->i++)
 		PT_SPAWN_AND_CHECK(&c->leaf, i2c_ctx_getdata(c, out + c->i));
 
+	PROBE3(write_read__done, addr, in_len, out_len);
 	PT_END();
 }
+
+static void trace_close(void)
+{
+	if (trace) {
+		fclose(trace);
+		trace = NULL;
+	}
+
+	if (replay) {
+		fprintf(stderr, "Replayed %u transactions (%u mismatched) in "
+				"%llu us\n",
+			replay_count, replay_mismatches,
+			(unsigned long long) (time_now() - replay_start));
+		fclose(replay);
+		replay = NULL;
+		replay_free_pending();
+	}
+}
+
+static int trace_record(const char *fname)
+{
+	trace_header_t h = { .magic = TRACE_MAGIC, .version = TRACE_VERSION };
+
+	trace_close();
+
+	trace = fopen(fname, "wb");
+	if (!trace) {
+		fprintf(stderr, "Cannot open trace file: %s\n", strerror(errno));
+		return -1;
+	}
+
+	fwrite(&h, sizeof(h), 1, trace);
+	return 0;
+}
+
+static int trace_replay(const char *fname)
+{
+	trace_header_t h;
+
+	trace_close();
+
+	replay = fopen(fname, "rb");
+	if (!replay) {
+		fprintf(stderr, "Cannot open trace file: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (1 != fread(&h, sizeof(h), 1, replay) ||
+	    0 != memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) ||
+	    h.version != TRACE_VERSION) {
+		fprintf(stderr, "Bad trace file: %s\n", fname);
+		fclose(replay);
+		replay = NULL;
+		return -1;
+	}
+
+	replay_count = 0;
+	replay_mismatches = 0;
+	replay_start = time_now();
+	return 0;
+}
+
+int i2c_ctx_trace_record(const char *fname)
+{
+	pthread_mutex_lock(&lock);
+	int res = trace_record(fname);
+	pthread_mutex_unlock(&lock);
+
+	return res;
+}
+
+int i2c_ctx_trace_replay(const char *fname)
+{
+	pthread_mutex_lock(&lock);
+	int res = trace_replay(fname);
+	pthread_mutex_unlock(&lock);
+
+	return res;
+}
+
+void i2c_ctx_trace_close(void)
+{
+	pthread_mutex_lock(&lock);
+	trace_close();
+	pthread_mutex_unlock(&lock);
+}
+
+void i2c_ctx_set_transport(i2c_ctx_transport_t *fn)
+{
+	pthread_mutex_lock(&lock);
+	transport = fn;
+	pthread_mutex_unlock(&lock);
+}
+
+void i2c_ctx_usleep(unsigned int usec)
+{
+	bool replaying;
+
+	if (vclock_enabled()) {
+		vclock_sleep(usec);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	replaying = replay != NULL;
+	pthread_mutex_unlock(&lock);
+
+	if (!replaying)
+		usleep(usec);
+}
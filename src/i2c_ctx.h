@@ -20,6 +20,7 @@
 #ifndef RF_I2C_CTX_H_
 #define RF_I2C_CTX_H_
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <librfn/protothreads.h>
@@ -37,19 +38,67 @@
  * @{
  */
 
+#define I2C_CTX_MAX_BUSES 4
+#define I2C_CTX_NO_BUS 0xff //!< Context could not be given a bus
+
+typedef struct i2c_regcache_entry {
+	uint8_t reg;
+	uint8_t val;
+	bool valid;
+	bool readonly; //!< Kept by i2c_ctx_regcache_invalidate()
+} i2c_regcache_entry_t;
+
+/*!
+ * \brief Register cache for a single device.
+ *
+ * Only registers listed in the entry table are cached. Reads of a cached
+ * register made using i2c_ctx_getreg() are served from the cache once it
+ * has been read (or written) and i2c_ctx_setreg() writes through to the
+ * cache. It is therefore only suitable for registers that are read-only
+ * or that are changed solely by this driver.
+ *
+ * Caches are attached to a bus so they are shared by every context
+ * talking to that device.
+ */
+typedef struct i2c_regcache {
+	struct i2c_regcache *next;
+	uint16_t addr;
+	int8_t bus; //!< Bus the cache is attached to (-1 if detached)
+	uint8_t num_entries;
+	i2c_regcache_entry_t *entry;
+} i2c_regcache_t;
+
+/*!
+ * \brief Per-bus transfer state.
+ *
+ * Only one transaction per bus is ever in flight so the message array and
+ * scratch buffers are owned by the bus and leased to whichever context is
+ * running a transaction. The lease is taken by the first i2c_ctx_start()
+ * of a transaction and returned when the transaction completes or fails.
+ * Contexts in different threads may share a bus; the lease is taken
+ * atomically and the register caches are guarded by the bus table lock.
+ */
+typedef struct i2c_bus {
+	uint32_t pi2c;
+	int fd;
+	_Atomic(struct i2c_ctx *) owner; //!< Context leasing the buffers
+	i2c_regcache_t *caches;
+
+	struct i2c_msg msgs[4];
+	uint8_t buf[128];
+} i2c_bus_t;
+
 typedef struct i2c_ctx {
 	pt_t pt;      //!< Protothread state for high-level functions
 	pt_t leaf;    //!< Protothread state for low-level functions
 
 	bool verbose; //!< Automatically print error reports
 
+	uint8_t bus;  //!< Index into the bus table (or I2C_CTX_NO_BUS)
 	int8_t msg_index;
 	int8_t bytes_read;
-	struct i2c_msg msgs[4];
-	uint8_t buf[128];
-
 
-	int i; //!< Used by "detect"
+	uint8_t i; //!< Used by "detect" and the burst transfers
 } i2c_ctx_t;
 
 typedef struct i2c_device_map {
@@ -61,6 +110,10 @@ typedef struct i2c_device_map {
  *
  * The context must be reinitialized before each I2C transaction otherwise
  * the transaction may timeout immediately.
+ *
+ * The bus is opened the first time it is used and stays open. At most
+ * I2C_CTX_MAX_BUSES buses can be open at once; if the table is full the
+ * context is left without a bus and every transaction on it fails.
  */
 void i2c_ctx_init(i2c_ctx_t *c, uint32_t pi2c);
 
@@ -73,6 +126,9 @@ void i2c_ctx_reset(i2c_ctx_t *c);
  * \brief Send a start condition.
  *
  * \note This is a low-level protothread; c->leaf must be zeroed by PT_SPAWN().
+ *
+ * The first start of a transaction waits until the bus buffers can be
+ * leased to this context.
  */
 pt_state_t i2c_ctx_start(i2c_ctx_t *c);
 
@@ -142,6 +198,41 @@ pt_state_t i2c_ctx_setreg(i2c_ctx_t *c, uint16_t addr, uint16_t reg,
 pt_state_t i2c_ctx_getreg(i2c_ctx_t *c, uint16_t addr, uint16_t reg,
 			  uint8_t *val);
 
+/*!
+ * \brief Initialize a register cache.
+ *
+ * Must be called only once for each cache (reinitializing the cache
+ * discards the cached values). entry must have room for num_regs
+ * entries.
+ */
+void i2c_regcache_init(i2c_regcache_t *rc, uint16_t addr,
+		       i2c_regcache_entry_t *entry, const uint8_t *regs,
+		       uint8_t num_regs);
+
+/*!
+ * \brief Mark a cached register as read-only.
+ *
+ * Read-only registers (chip IDs, calibration ROM) cannot be changed by a
+ * device reset so their cached values survive
+ * i2c_ctx_regcache_invalidate().
+ */
+void i2c_regcache_set_readonly(i2c_regcache_t *rc, uint8_t reg);
+
+/*!
+ * \brief Attach a register cache to the context's bus.
+ *
+ * Must be called after i2c_ctx_init(). Attaching a cache that is already
+ * attached to the same bus has no effect.
+ */
+void i2c_ctx_regcache_attach(i2c_ctx_t *c, i2c_regcache_t *rc);
+
+/*!
+ * \brief Discard the cached registers for a device (e.g. after a reset).
+ *
+ * Registers marked with i2c_regcache_set_readonly() are kept.
+ */
+void i2c_ctx_regcache_invalidate(i2c_ctx_t *c, uint16_t addr);
+
 /*!
  * \brief Burst write to an I2C device.
  *
@@ -165,6 +256,57 @@ pt_state_t i2c_ctx_read(i2c_ctx_t *c, uint16_t addr, uint8_t *data,
 pt_state_t i2c_ctx_write_read(i2c_ctx_t *c, uint16_t addr, const uint8_t *in,
 			      uint8_t in_len, uint8_t *out, uint8_t out_len);
 
+/*!
+ * \brief Record every I2C transaction to a trace file.
+ *
+ * Each transaction is recorded with its messages, payloads, result and
+ * a timestamp. Returns -1 if the file cannot be opened.
+ */
+int i2c_ctx_trace_record(const char *fname);
+
+/*!
+ * \brief Replay I2C responses from a trace file instead of using the bus.
+ *
+ * Read payloads and results are fed back to the drivers in the order they
+ * were recorded on each bus (buses are matched independently so threads
+ * sampling different buses may run in any order) and delays requested
+ * with i2c_ctx_usleep() are skipped so the replay runs as fast as
+ * possible. Returns -1 if the file cannot be opened or is not a trace.
+ */
+int i2c_ctx_trace_replay(const char *fname);
+
+/*!
+ * \brief Stop recording or replaying and report replay statistics.
+ */
+void i2c_ctx_trace_close(void);
+
+/*!
+ * \brief Stand-in for the I2C_RDWR ioctl.
+ *
+ * Must return the number of messages transferred or -1 (setting errno).
+ * Transports are called with the bus table locked so they need no
+ * locking of their own.
+ */
+typedef int i2c_ctx_transport_t(uint32_t pi2c, struct i2c_msg *msgs,
+				unsigned int nmsgs);
+
+/*!
+ * \brief Route transactions to a simulated bus instead of /dev/i2c-N.
+ *
+ * Passing NULL returns to the hardware. Transactions are still traced if
+ * trace recording is active.
+ */
+void i2c_ctx_set_transport(i2c_ctx_transport_t *fn);
+
+/*!
+ * \brief Wait for a conversion to complete.
+ *
+ * Drivers should use this rather than usleep() so that delays can be
+ * skipped when replaying a trace and advance the virtual clock when
+ * simulating.
+ */
+void i2c_ctx_usleep(unsigned int usec);
+
 /*! @} */
 
 #endif // RF_I2C_CTX_H_
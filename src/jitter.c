@@ -0,0 +1,68 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "jitter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <librfn.h>
+
+void jitter_reset(jitter_t *j)
+{
+	memset(j, 0, sizeof(*j));
+}
+
+void jitter_record(jitter_t *j, int64_t lateness)
+{
+	if (!j->count || lateness < j->min)
+		j->min = lateness;
+	if (!j->count || lateness > j->max)
+		j->max = lateness;
+	j->sum += lateness;
+
+	if (lateness > INT32_MAX)
+		lateness = INT32_MAX;
+	if (lateness < INT32_MIN)
+		lateness = INT32_MIN;
+	j->recent[j->count % lengthof(j->recent)] = lateness;
+	j->count++;
+}
+
+int64_t jitter_mean(jitter_t *j)
+{
+	return j->count ? j->sum / j->count : 0;
+}
+
+static int compare_int32(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *) a;
+	int32_t y = *(const int32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+int64_t jitter_percentile(jitter_t *j, unsigned int pct)
+{
+	static int32_t sorted[JITTER_WINDOW];
+	unsigned int n =
+	    j->count < lengthof(j->recent) ? j->count : lengthof(j->recent);
+
+	if (!n)
+		return 0;
+
+	memcpy(sorted, j->recent, n * sizeof(sorted[0]));
+	qsort(sorted, n, sizeof(sorted[0]), compare_int32);
+
+	/* nearest-rank method */
+	unsigned int rank = (pct * n + 99) / 100;
+	return sorted[rank ? rank - 1 : 0];
+}
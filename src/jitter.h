@@ -0,0 +1,47 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_JITTER_H_
+#define RF_JITTER_H_
+
+#include <stdint.h>
+
+#define JITTER_WINDOW 1024
+
+/*!
+ * \brief Scheduling lateness statistics.
+ *
+ * Minimum, maximum and mean cover every sample since the last reset.
+ * Percentiles are calculated from the most recent JITTER_WINDOW samples.
+ */
+typedef struct jitter {
+	uint32_t count;
+	int64_t min;
+	int64_t max;
+	int64_t sum;
+
+	int32_t recent[JITTER_WINDOW];
+} jitter_t;
+
+void jitter_reset(jitter_t *j);
+void jitter_record(jitter_t *j, int64_t lateness);
+int64_t jitter_mean(jitter_t *j);
+int64_t jitter_percentile(jitter_t *j, unsigned int pct);
+
+#endif // RF_JITTER_H_
@@ -9,16 +9,33 @@
  * (at your option) any later version.
  */
 
+#include <sys/mman.h>
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "librfn.h"
 
+#include "adaptive.h"
+#include "alert.h"
+#include "bme280.h"
 #include "bmp180.h"
+#include "jitter.h"
+#include "probe.h"
+#include "shmtab.h"
 #include "si7021.h"
+#include "simbus.h"
+#include "spscq.h"
+#include "stats.h"
+#include "vclock.h"
 
 /*
  * Calculate the dew point using the August-Roche-Magnus
@@ -78,6 +95,172 @@ static pt_state_t console_bmp180(console_t *c)
 static const console_cmd_t cmd_bmp180 =
     CONSOLE_CMD_VAR_INIT("bmp180", console_bmp180);
 
+static pt_state_t console_trace(console_t *c)
+{
+	if (c->argc != 2)
+		fprintf(c->out, "Usage: trace <file>|off\n");
+	else if (0 == strcmp(c->argv[1], "off"))
+		i2c_ctx_trace_close();
+	else
+		(void) i2c_ctx_trace_record(c->argv[1]);
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_trace =
+    CONSOLE_CMD_VAR_INIT("trace", console_trace);
+
+static pt_state_t console_replay(console_t *c)
+{
+	if (c->argc != 2)
+		fprintf(c->out, "Usage: replay <file>|off\n");
+	else if (0 == strcmp(c->argv[1], "off"))
+		i2c_ctx_trace_close();
+	else
+		(void) i2c_ctx_trace_replay(c->argv[1]);
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_replay =
+    CONSOLE_CMD_VAR_INIT("replay", console_replay);
+
+/*
+ * Simulated runs: "vclock <seconds>" makes csv run on a virtual clock for
+ * the given (virtual) duration, jumping straight to each deadline, and
+ * "simbus" replaces the hardware with simulated sensors. Together (or
+ * with replay) they allow months of acquisition to be soak tested in
+ * seconds.
+ */
+static pt_state_t console_vclock(console_t *c)
+{
+	if (c->argc != 2)
+		fprintf(c->out, "Usage: vclock <seconds>|off\n");
+	else if (0 == strcmp(c->argv[1], "off"))
+		vclock_disable();
+	else
+		vclock_enable(strtoull(c->argv[1], NULL, 0) * 1000000);
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_vclock =
+    CONSOLE_CMD_VAR_INIT("vclock", console_vclock);
+
+static pt_state_t console_simbus(console_t *c)
+{
+	if (c->argc > 2 ||
+	    (c->argc == 2 && 0 != strcmp(c->argv[1], "off")))
+		fprintf(c->out, "Usage: simbus [off]\n");
+	else
+		i2c_ctx_set_transport(c->argc == 2 ? NULL : simbus_rdwr);
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_simbus =
+    CONSOLE_CMD_VAR_INIT("simbus", console_simbus);
+
+static pt_state_t console_bme280(console_t *c)
+{
+	/* one instance per address so each keeps its own register cache */
+	static bme280_t bme280[2];
+	static bme280_t *s;
+	static int32_t raw_temp, raw_pressure, raw_rh;
+	static const long max[] = { BME280_OSRS_X16, BME280_OSRS_X16,
+				    BME280_OSRS_X16, BME280_FILTER_16,
+				    BME280_STANDBY_20MS };
+	long val[] = { BME280_OSRS_X1, BME280_OSRS_X1, BME280_OSRS_X1,
+		       BME280_FILTER_OFF, BME280_STANDBY_1000MS };
+	char **argv = c->argv;
+	int argc = c->argc;
+	long addr = 0x76;
+	bool ok;
+	char *end;
+
+	PT_BEGIN(&c->pt);
+
+	if (argc >= 3 && 0 == strcmp(argv[1], "-a")) {
+		addr = strtol(argv[2], NULL, 0);
+		argv += 2;
+		argc -= 2;
+	}
+
+	ok = (argc == 1 || argc == 4 || argc == 6) &&
+	     (addr == 0x76 || addr == 0x77);
+	for (int i = 1; ok && i < argc; i++) {
+		val[i - 1] = strtol(argv[i], &end, 0);
+		ok = !*end && val[i - 1] >= 0 && val[i - 1] <= max[i - 1];
+	}
+
+	if (!ok) {
+		fprintf(c->out, "Usage: bme280 [-a 0x76|0x77] "
+				"[<osrs_t> <osrs_p> <osrs_h> "
+				"[<filter> <standby>]]\n"
+				"       osrs 0-5 (0 skips), filter 0-4, "
+				"standby 0-7\n");
+		PT_EXIT();
+	}
+
+	s = &bme280[addr - 0x76];
+	s->addr = addr;
+	s->osrs_t = val[0];
+	s->osrs_p = val[1];
+	s->osrs_h = val[2];
+	s->filter = val[3];
+	s->t_sb = val[4];
+
+	PT_SPAWN_AND_CHECK(&s->pt, bme280_init(s, pi2c));
+	PT_SPAWN_AND_CHECK(&s->pt, bme280_get_raw(s, &raw_temp, &raw_pressure,
+						  &raw_rh));
+
+	/* pressure and humidity compensation both need the temperature */
+	if (!s->osrs_t)
+		PT_EXIT();
+
+	int t = bme280_get_temp(s, raw_temp);
+
+	printf("Temp: %d.%d\n", t / 10, t % 10);
+	if (s->osrs_p)
+		printf("Pressure: %d\n", bme280_get_pressure(s, raw_pressure));
+	if (s->has_humidity && s->osrs_h) {
+		int rh = bme280_get_humidity(s, raw_rh);
+		int dp = dew_point(t, rh);
+
+		printf("Relative humidity: %d\n", rh);
+		printf("Dew point: %d.%d\n", dp / 10, dp % 10);
+	}
+
+	PT_END();
+}
+static const console_cmd_t cmd_bme280 =
+    CONSOLE_CMD_VAR_INIT("bme280", console_bme280);
+
+static uint8_t si7021_resolution = SI7021_RES_RH12_T14;
+
+static pt_state_t console_si7021res(console_t *c)
+{
+	int bits = c->argc == 2 ? strtol(c->argv[1], NULL, 0) : 0;
+
+	switch (bits) {
+	case 12:
+		si7021_resolution = SI7021_RES_RH12_T14;
+		break;
+	case 11:
+		si7021_resolution = SI7021_RES_RH11_T11;
+		break;
+	case 10:
+		si7021_resolution = SI7021_RES_RH10_T13;
+		break;
+	case 8:
+		si7021_resolution = SI7021_RES_RH8_T12;
+		break;
+	default:
+		fprintf(c->out, "Usage: si7021res 8|10|11|12\n");
+		break;
+	}
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_si7021res =
+    CONSOLE_CMD_VAR_INIT("si7021res", console_si7021res);
+
 static pt_state_t console_si7021(console_t *c)
 {
 	static si7021_t si7021;
@@ -85,6 +268,7 @@ static pt_state_t console_si7021(console_t *c)
 
 	PT_BEGIN(&c->pt);
 
+	si7021.resolution = si7021_resolution;
 	PT_SPAWN_AND_CHECK(&si7021.pt, si7021_init(&si7021, pi2c));
 	PT_SPAWN_AND_CHECK(&si7021.pt, si7021_get_raw_temp(&si7021, &raw_temp));
 	PT_SPAWN_AND_CHECK(&si7021.pt,
@@ -103,67 +287,1260 @@ static pt_state_t console_si7021(console_t *c)
 static const console_cmd_t cmd_si7021 =
     CONSOLE_CMD_VAR_INIT("si7021", console_si7021);
 
+enum { CSV_T1, CSV_RH, CSV_T2, CSV_P, CSV_NUM_CHANNELS };
+
+/* interval limits are in seconds, thresholds in units of 0.1C, %RH and Pa */
+static uint32_t csv_floor = 5 * 60;
+static uint32_t csv_ceiling = 5 * 60;
+static int32_t csv_threshold[CSV_NUM_CHANNELS] = { 5, 2, 5, 50 };
+
+static pt_state_t console_adaptive(console_t *c)
+{
+	if (c->argc != 3 && c->argc != 6) {
+		fprintf(c->out, "Usage: adaptive <floor> <ceiling> "
+				"[<temp> <rh> <pressure>]\n");
+		return PT_EXITED;
+	}
+
+	csv_floor = strtol(c->argv[1], NULL, 0);
+	csv_ceiling = strtol(c->argv[2], NULL, 0);
+	if (csv_floor < 1)
+		csv_floor = 1;
+	if (c->argc == 6) {
+		csv_threshold[CSV_T1] = strtol(c->argv[3], NULL, 0);
+		csv_threshold[CSV_RH] = strtol(c->argv[4], NULL, 0);
+		csv_threshold[CSV_T2] = csv_threshold[CSV_T1];
+		csv_threshold[CSV_P] = strtol(c->argv[5], NULL, 0);
+	}
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_adaptive =
+    CONSOLE_CMD_VAR_INIT("adaptive", console_adaptive);
+
+/*
+ * BMP180 temperature cache lifetime (microseconds) and the change in Si7021
+ * temperature (0.1C) that forces an early refresh.
+ */
+static uint64_t csv_temp_refresh;
+static int32_t csv_temp_delta = 5;
+
+static pt_state_t console_b5cache(console_t *c)
+{
+	long long secs = -1, delta = csv_temp_delta;
+	char *end = "";
+
+	if (c->argc == 2 || c->argc == 3) {
+		errno = 0;
+		secs = strtoll(c->argv[1], &end, 0);
+		if (c->argc == 3 && !*end)
+			delta = strtoll(c->argv[2], &end, 0);
+		if (errno || *end)
+			secs = -1;
+	}
+
+	if (secs < 0 || (unsigned long long) secs > UINT64_MAX / 1000000 ||
+	    delta < 0 || delta > INT32_MAX) {
+		fprintf(c->out, "Usage: b5cache <seconds> [<temp-delta>]\n");
+		return PT_EXITED;
+	}
+
+	csv_temp_refresh = secs * 1000000ull;
+	csv_temp_delta = delta;
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_b5cache =
+    CONSOLE_CMD_VAR_INIT("b5cache", console_b5cache);
+
+/*
+ * When the reporting window is non-zero the acquisition loop emits one
+ * summary record (min/max/mean/stddev/count for each quantity) per window
+ * instead of a record per sample.
+ */
+static uint32_t csv_window;
+
+static pt_state_t console_window(console_t *c)
+{
+	if (c->argc != 2)
+		fprintf(c->out, "Usage: window <seconds>\n");
+	else
+		csv_window = strtol(c->argv[1], NULL, 0);
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_window =
+    CONSOLE_CMD_VAR_INIT("window", console_window);
+
+/*
+ * Multi-rate sampling. When any quantity has a non-zero period (seconds)
+ * each quantity is sampled on its own schedule, offset by its phase, and
+ * quantities with no period are not sampled at all. Records only contain
+ * the quantities measured at that time. The adaptive interval and the
+ * BMP180 temperature cache heuristics apply only to lockstep sampling.
+ */
+static uint32_t csv_period[CSV_NUM_CHANNELS];
+static uint32_t csv_phase[CSV_NUM_CHANNELS];
+
+static bool csv_multirate(void)
+{
+	for (int i = 0; i < CSV_NUM_CHANNELS; i++)
+		if (csv_period[i])
+			return true;
+
+	return false;
+}
+
+static pt_state_t console_rate(console_t *c)
+{
+	static const char *names[CSV_NUM_CHANNELS] = { "t1", "rh", "t2",
+						       "p" };
+	int q;
+
+	if (c->argc == 2 && 0 == strcmp(c->argv[1], "off")) {
+		memset(csv_period, 0, sizeof(csv_period));
+		memset(csv_phase, 0, sizeof(csv_phase));
+		return PT_EXITED;
+	}
+
+	for (q = 0; q < CSV_NUM_CHANNELS && c->argc >= 3; q++)
+		if (0 == strcmp(c->argv[1], names[q]))
+			break;
+
+	if (c->argc < 3 || c->argc > 4 || q >= CSV_NUM_CHANNELS) {
+		fprintf(c->out, "Usage: rate t1|rh|t2|p <period> [<phase>]\n"
+				"       rate off\n");
+		return PT_EXITED;
+	}
+
+	csv_period[q] = strtol(c->argv[2], NULL, 0);
+	csv_phase[q] = c->argc == 4 ? strtol(c->argv[3], NULL, 0) : 0;
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_rate =
+    CONSOLE_CMD_VAR_INIT("rate", console_rate);
+
+/*
+ * Threshold alerts are evaluated by the acquisition loop on every sample
+ * but only state transitions are passed on. The output thread writes them
+ * to the alert log (stderr by default) and runs the hook command, if any,
+ * as "<hook> <quantity> high|low raised|cleared <value> <bus>".
+ *
+ * Limits use the same units as the adaptive thresholds (0.1C, %RH and Pa)
+ * and the hold-off is in seconds. Rules should be configured before
+ * starting csv.
+ */
+enum { CSV_DP = CSV_NUM_CHANNELS, CSV_NUM_QUANTITIES };
+
+static const struct {
+	const char *name;
+	int scale;
+	int digits;
+} csv_quantity[CSV_NUM_QUANTITIES] = {
+	{ "t1", 10, 1 }, { "rh", 1, 0 }, { "t2", 10, 1 },
+	{ "p", 1000, 3 }, { "dp", 10, 1 },
+};
+
+#define CSV_MAX_ALERTS 8
+
+typedef struct csv_alert_rule {
+	unsigned int quantity;
+	alert_rule_t rule;
+} csv_alert_rule_t;
+
+static csv_alert_rule_t csv_alert_rules[CSV_MAX_ALERTS];
+static unsigned int csv_num_alerts;
+static FILE *csv_alert_log;
+static char csv_alert_hook[256];
+
+static int csv_quantity_lookup(const char *name)
+{
+	for (int i = 0; i < CSV_NUM_QUANTITIES; i++)
+		if (0 == strcmp(name, csv_quantity[i].name))
+			return i;
+
+	return -1;
+}
+
+static pt_state_t console_alert(console_t *c)
+{
+	csv_alert_rule_t *r;
+	int q;
+
+	if (c->argc == 2 && 0 == strcmp(c->argv[1], "clear")) {
+		csv_num_alerts = 0;
+		return PT_EXITED;
+	}
+
+	if (c->argc == 3 && 0 == strcmp(c->argv[1], "log")) {
+		FILE *f = stderr;
+
+		if (0 != strcmp(c->argv[2], "-")) {
+			f = fopen(c->argv[2], "a");
+			if (!f) {
+				fprintf(stderr, "Cannot open %s (%s)\n",
+					c->argv[2], strerror(errno));
+				return PT_FAILED;
+			}
+			setvbuf(f, NULL, _IOLBF, 0);
+		}
+
+		if (csv_alert_log && csv_alert_log != stderr)
+			fclose(csv_alert_log);
+		csv_alert_log = f;
+		return PT_EXITED;
+	}
+
+	if (c->argc >= 3 && 0 == strcmp(c->argv[1], "hook")) {
+		csv_alert_hook[0] = '\0';
+		if (0 == strcmp(c->argv[2], "off"))
+			return PT_EXITED;
+
+		for (int i = 2; i < c->argc; i++) {
+			size_t len = strlen(csv_alert_hook);
+
+			snprintf(csv_alert_hook + len,
+				 sizeof(csv_alert_hook) - len, "%s%s",
+				 i > 2 ? " " : "", c->argv[i]);
+		}
+		return PT_EXITED;
+	}
+
+	q = c->argc >= 4 ? csv_quantity_lookup(c->argv[1]) : -1;
+	if (c->argc > 6 || q < 0 ||
+	    (0 != strcmp(c->argv[2], "high") &&
+	     0 != strcmp(c->argv[2], "low"))) {
+		fprintf(c->out, "Usage: alert t1|rh|t2|p|dp high|low <limit> "
+				"[<hysteresis> [<holdoff>]]\n"
+				"       alert clear\n"
+				"       alert log <file>|-\n"
+				"       alert hook <command>|off\n");
+		return PT_EXITED;
+	}
+
+	if (csv_num_alerts >= lengthof(csv_alert_rules)) {
+		fprintf(stderr, "Too many alerts\n");
+		return PT_FAILED;
+	}
+
+	r = &csv_alert_rules[csv_num_alerts++];
+	memset(r, 0, sizeof(*r));
+	r->quantity = q;
+	r->rule.low = 0 == strcmp(c->argv[2], "low");
+	r->rule.limit = strtol(c->argv[3], NULL, 0);
+	if (c->argc >= 5)
+		r->rule.hysteresis = strtol(c->argv[4], NULL, 0);
+	if (c->argc >= 6)
+		r->rule.holdoff = strtoull(c->argv[5], NULL, 0) * 1000000;
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_alert =
+    CONSOLE_CMD_VAR_INIT("alert", console_alert);
+
+/*
+ * Samples are handed from the acquisition loops to the output thread via
+ * lock-free queues so that a stalled stdout cannot delay the next I2C
+ * transaction. Dew point, formatting and stdio all run on the output
+ * thread.
+ */
+typedef struct csv_stamp {
+	uint64_t mono; //!< CLOCK_MONOTONIC (ns)
+	uint64_t real; //!< CLOCK_REALTIME (ns)
+} csv_stamp_t;
+
+#define CSV_ALL ((1 << CSV_NUM_CHANNELS) - 1)
+#define CSV_BIT(q) (1 << (q))
+
+typedef struct csv_sample {
+	csv_stamp_t stamp[CSV_NUM_CHANNELS]; //!< Time each conversion completed
+	uint8_t fresh; //!< Quantities measured for this record (CSV_BIT())
+	uint8_t known; //!< Quantities that have ever been measured
+	int16_t t1;
+	int16_t rh;
+	int16_t t2;
+	int32_t p;
+	uint32_t interval; //!< Sample interval in effect (seconds)
+	uint32_t bus;
+
+	uint32_t window; //!< Window length (seconds) or 0 if not a summary
+	csv_stamp_t window_stamp; //!< Start of the window (summaries only)
+	stats_t stats[CSV_NUM_CHANNELS];
+} csv_sample_t;
+
+typedef struct csv_event {
+	csv_stamp_t stamp;
+	int32_t value;
+	uint32_t bus;
+	uint8_t rule;
+	bool active;
+} csv_event_t;
+
+/*
+ * Multi-rate conversions are grouped by device: each device can only run
+ * one conversion at a time but the devices convert in parallel.
+ */
+enum { CSV_LANE_SI7021, CSV_LANE_BMP180, CSV_NUM_LANES };
+
+typedef struct csv_lane {
+	uint8_t op[2];    //!< Quantities to convert, in order
+	uint8_t num_ops;
+	uint8_t next;     //!< Index of the running conversion
+	uint64_t ready;   //!< Time the running conversion completes
+} csv_lane_t;
+
+/*
+ * Each bus has its own acquisition loop, sensors and queue. A single bus
+ * can be sampled from the console fibre; when several buses are listed
+ * each runs in its own thread so that their transactions proceed in
+ * parallel. The output thread merges the queues.
+ */
+typedef struct csv_worker {
+	pt_t pt;
+	uint32_t pi2c;
+	unsigned int index;
+	atomic_bool running;
+
+	si7021_t si7021;
+	bmp180_t bmp180;
+	uint16_t raw_temp1, raw_rh, raw_temp2;
+	uint32_t raw_pressure;
+
+	uint64_t timeout;
+	uint64_t due[CSV_NUM_CHANNELS]; //!< Next deadline (multi-rate only)
+	csv_lane_t lane[CSV_NUM_LANES];
+	unsigned int lane_sel;
+	pt_t lane_pt;
+	adaptive_t adaptive;
+	jitter_t jitter;
+	csv_sample_t sample;
+	uint64_t window_start;
+	uint64_t temp_stamp; //!< BMP180 temperature conversion time...
+	int16_t temp_t1;     //!< ... and the Si7021 temperature at that time
+	bool temp_due;       //!< BMP180 temperature must be converted
+	char shm_name[2][12];
+	alert_t alert[CSV_MAX_ALERTS];
+
+	spscq_t queue;
+	csv_sample_t queue_buf[64];
+	unsigned int dropped; //!< Owned by the output thread
+
+	spscq_t event_queue;
+	csv_event_t event_buf[16];
+	unsigned int events_dropped; //!< Owned by the output thread
+
+	pthread_t thread;
+	bool joinable; //!< thread was started by csv and not yet joined
+} csv_worker_t;
+
+static csv_worker_t csv_workers[I2C_CTX_MAX_BUSES];
+static atomic_uint csv_num_workers;
+static atomic_uint csv_num_threads;
+static atomic_uint csv_num_failed;
+static sem_t csv_queue_sem;
+static sem_t csv_flush_sem;
+static atomic_bool csv_flush_requested;
+
+enum { SHM_SI7021, SHM_BMP180 };
+
+static shmtab_t *csv_shmtab;
+
+static void csv_stamp(csv_stamp_t *stamp)
+{
+	struct timespec ts;
+
+	if (vclock_enabled()) {
+		stamp->mono = vclock_now() * 1000;
+		stamp->real = vclock_realtime();
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	stamp->mono = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	stamp->real = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//! Stamp an earlier time, t, taken from vclock_now().
+static void csv_stamp_at(csv_stamp_t *stamp, uint64_t t)
+{
+	uint64_t ago = (vclock_now() - t) * 1000;
+
+	csv_stamp(stamp);
+	stamp->mono -= ago;
+	stamp->real -= ago;
+}
+
+/*
+ * Dew point is reported whenever either of its inputs is fresh (using the
+ * most recent value of the other).
+ */
+static bool csv_dew_point_fresh(const csv_sample_t *s)
+{
+	uint8_t inputs = CSV_BIT(CSV_T1) | CSV_BIT(CSV_RH);
+
+	return (s->fresh & inputs) && (s->known & inputs) == inputs;
+}
+
+/*
+ * Quantities that were not measured for this record (multi-rate sampling
+ * only) are left empty.
+ */
+static void csv_print(const csv_sample_t *s)
+{
+	char stamp[24];
+	int q = 0;
+
+	while (q < CSV_NUM_CHANNELS - 1 && !(s->fresh & CSV_BIT(q)))
+		q++;
+
+	time_t secs = s->stamp[q].real / 1000000000;
+	unsigned int usecs = (s->stamp[q].real % 1000000000) / 1000;
+
+	strftime(stamp, sizeof(stamp), "%FT%H:%M:%S", localtime(&secs));
+	printf("%s.%06u", stamp, usecs);
+	if (s->fresh & CSV_BIT(CSV_T1))
+		printf(",%2d.%d", s->t1 / 10, s->t1 % 10);
+	else
+		printf(",");
+	if (s->fresh & CSV_BIT(CSV_RH))
+		printf(",%d", s->rh);
+	else
+		printf(",");
+	if (s->fresh & CSV_BIT(CSV_T2))
+		printf(",%2d.%d", s->t2 / 10, s->t2 % 10);
+	else
+		printf(",");
+	if (s->fresh & CSV_BIT(CSV_P))
+		printf(",%3d.%03d", s->p / 1000, s->p % 1000);
+	else
+		printf(",");
+	if (csv_dew_point_fresh(s)) {
+		int dp = dew_point(s->t1, s->rh);
+
+		printf(",%2d.%d", dp / 10, dp % 10);
+	} else {
+		printf(",");
+	}
+	printf(",%u,%u\n", s->interval, s->bus);
+}
+
+/*
+ * Quantities that were not sampled during the window (multi-rate sampling
+ * only) are left empty.
+ */
+static void csv_print_stats(const stats_t *s, double scale)
+{
+	if (!s->count) {
+		printf(",,,,,");
+		return;
+	}
+
+	printf(",%.3f,%.3f,%.3f,%.3f,%u", s->min / scale, s->max / scale,
+	       s->mean / scale, stats_stddev(s) / scale, s->count);
+}
+
+static void csv_print_summary(const csv_sample_t *s)
+{
+	char stamp[24];
+	time_t secs = s->window_stamp.real / 1000000000;
+	unsigned int usecs = (s->window_stamp.real % 1000000000) / 1000;
+
+	strftime(stamp, sizeof(stamp), "%FT%H:%M:%S", localtime(&secs));
+	printf("%s.%06u", stamp, usecs);
+	csv_print_stats(&s->stats[CSV_T1], 10);
+	csv_print_stats(&s->stats[CSV_RH], 1);
+	csv_print_stats(&s->stats[CSV_T2], 10);
+	csv_print_stats(&s->stats[CSV_P], 1000);
+	printf(",%u,%u\n", s->window, s->bus);
+}
+
+static void csv_print_event(const csv_event_t *e)
+{
+	const csv_alert_rule_t *r = &csv_alert_rules[e->rule];
+	const char *name = csv_quantity[r->quantity].name;
+	const char *dir = r->rule.low ? "low" : "high";
+	const char *state = e->active ? "raised" : "cleared";
+	int digits = csv_quantity[r->quantity].digits;
+	double value = (double) e->value / csv_quantity[r->quantity].scale;
+	FILE *f = csv_alert_log ? csv_alert_log : stderr;
+	char stamp[24];
+	time_t secs = e->stamp.real / 1000000000;
+	unsigned int usecs = (e->stamp.real % 1000000000) / 1000;
+
+	strftime(stamp, sizeof(stamp), "%FT%H:%M:%S", localtime(&secs));
+	fprintf(f, "%s.%06u,%s,%s,%s,%.*f,%u\n", stamp, usecs, name, dir,
+		state, digits, value, e->bus);
+
+	if (csv_alert_hook[0]) {
+		char cmd[sizeof(csv_alert_hook) + 64];
+
+		snprintf(cmd, sizeof(cmd), "%s %s %s %s %.*f %u",
+			 csv_alert_hook, name, dir, state, digits, value,
+			 e->bus);
+		if (0 != system(cmd))
+			fprintf(stderr, "Alert hook failed: %s\n", cmd);
+	}
+}
+
+static void csv_output_drain(void)
+{
+	csv_sample_t sample;
+	csv_event_t event;
+	unsigned int n = atomic_load(&csv_num_workers);
+
+	for (unsigned int i = 0; i < n; i++) {
+		csv_worker_t *w = &csv_workers[i];
+
+		while (spscq_receive(&w->event_queue, &event))
+			csv_print_event(&event);
+
+		if (w->events_dropped != spscq_dropped(&w->event_queue)) {
+			w->events_dropped = spscq_dropped(&w->event_queue);
+			fprintf(stderr,
+				"Output stalled: %u alerts dropped from bus "
+				"%u\n",
+				w->events_dropped, w->pi2c);
+		}
+
+		while (spscq_receive(&w->queue, &sample)) {
+			if (sample.window)
+				csv_print_summary(&sample);
+			else
+				csv_print(&sample);
+		}
+
+		if (w->dropped != spscq_dropped(&w->queue)) {
+			w->dropped = spscq_dropped(&w->queue);
+			fprintf(stderr,
+				"Output stalled: %u samples dropped from bus "
+				"%u\n",
+				w->dropped, w->pi2c);
+		}
+	}
+}
+
+static void *csv_output_thread(void *arg)
+{
+	while (1) {
+		while (0 != sem_wait(&csv_queue_sem))
+			;
+
+		csv_output_drain();
+
+		if (atomic_exchange(&csv_flush_requested, false)) {
+			/* catch anything queued behind the first pass */
+			csv_output_drain();
+			fflush(stdout);
+			if (csv_alert_log)
+				fflush(csv_alert_log);
+			sem_post(&csv_flush_sem);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Wait until everything queued so far has been written out. Acquisition
+ * must already have stopped.
+ */
+static void csv_output_flush(void)
+{
+	atomic_store(&csv_flush_requested, true);
+	sem_post(&csv_queue_sem);
+	while (0 != sem_wait(&csv_flush_sem))
+		;
+}
+
+static int csv_output_start(void)
+{
+	static bool started;
+	pthread_t thread;
+
+	if (started)
+		return 0;
+
+	if (0 != sem_init(&csv_queue_sem, 0, 0) ||
+	    0 != sem_init(&csv_flush_sem, 0, 0) ||
+	    0 != pthread_create(&thread, NULL, csv_output_thread, NULL)) {
+		fprintf(stderr, "Cannot start output thread\n");
+		return -1;
+	}
+
+	started = true;
+	return 0;
+}
+
+/*
+ * Find the worker for a bus, allocating one if needed. Workers are never
+ * freed so the output thread can scan them without locking.
+ */
+static csv_worker_t *csv_worker_get(uint32_t pi2c)
+{
+	unsigned int n = atomic_load(&csv_num_workers);
+	csv_worker_t *w;
+
+	for (unsigned int i = 0; i < n; i++)
+		if (csv_workers[i].pi2c == pi2c)
+			return &csv_workers[i];
+
+	if (n >= lengthof(csv_workers)) {
+		fprintf(stderr, "Too many I2C buses\n");
+		return NULL;
+	}
+
+	w = &csv_workers[n];
+	w->pi2c = pi2c;
+	w->index = n;
+	snprintf(w->shm_name[SHM_SI7021], sizeof(w->shm_name[0]),
+		 "si7021-%u", pi2c);
+	snprintf(w->shm_name[SHM_BMP180], sizeof(w->shm_name[0]),
+		 "bmp180-%u", pi2c);
+	spscq_init(&w->queue, w->queue_buf, sizeof(w->queue_buf[0]),
+		   lengthof(w->queue_buf));
+	spscq_init(&w->event_queue, w->event_buf, sizeof(w->event_buf[0]),
+		   lengthof(w->event_buf));
+	atomic_store(&csv_num_workers, n + 1);
+
+	return w;
+}
+
+static pt_state_t csv_init(csv_worker_t *w)
+{
+	PT_BEGIN(&w->pt);
+
+	adaptive_init(&w->adaptive, (uint64_t) csv_floor * 1000000,
+		      (uint64_t) csv_ceiling * 1000000);
+	for (int i = 0; i < CSV_NUM_CHANNELS; i++)
+		adaptive_set_threshold(&w->adaptive, i, csv_threshold[i]);
+	jitter_reset(&w->jitter);
+	for (int i = 0; i < CSV_NUM_CHANNELS; i++)
+		stats_reset(&w->sample.stats[i]);
+	for (int i = 0; i < CSV_MAX_ALERTS; i++)
+		alert_reset(&w->alert[i]);
+
+	w->si7021.resolution = si7021_resolution;
+	PT_SPAWN_AND_CHECK(&w->si7021.pt, si7021_init(&w->si7021, w->pi2c));
+	PT_SPAWN_AND_CHECK(&w->bmp180.pt, bmp180_init(&w->bmp180, w->pi2c));
+	/* csv expires the cache itself, on the (possibly virtual) csv clock */
+	bmp180_set_temp_refresh(&w->bmp180, csv_temp_refresh ? UINT64_MAX : 0);
+
+	w->timeout = w->window_start = vclock_now();
+	w->sample.known = 0;
+	for (int i = 0; i < CSV_NUM_CHANNELS; i++)
+		w->due[i] = w->timeout + csv_phase[i] * 1000000ull;
+
+	PT_END();
+}
+
+/*
+ * Simulated runs produce samples far faster than they can be printed so,
+ * rather than dropping them, wait for the output thread to catch up.
+ */
+static void csv_send(spscq_t *q, const void *msg)
+{
+	if (vclock_enabled()) {
+		while (spscq_full(q)) {
+			sem_post(&csv_queue_sem);
+			sched_yield();
+		}
+	}
+
+	spscq_send(q, msg);
+}
+
+/*
+ * Evaluate the alert rules against a new sample, passing any transitions
+ * to the output thread. Dew point is only calculated here if a rule needs
+ * it.
+ */
+static void csv_check_alerts(csv_worker_t *w, const csv_sample_t *s)
+{
+	int32_t value[CSV_NUM_QUANTITIES] = { s->t1, s->rh, s->t2, s->p };
+	bool have_dp = false;
+	uint64_t now = vclock_now();
+	bool sent = false;
+	csv_event_t e;
+
+	for (unsigned int i = 0; i < csv_num_alerts; i++) {
+		const csv_alert_rule_t *r = &csv_alert_rules[i];
+
+		if (r->quantity == CSV_DP ? !csv_dew_point_fresh(s)
+					  : !(s->fresh & CSV_BIT(r->quantity)))
+			continue;
+
+		if (r->quantity == CSV_DP && !have_dp) {
+			value[CSV_DP] = dew_point(s->t1, s->rh);
+			have_dp = true;
+		}
+
+		if (!alert_update(&w->alert[i], &r->rule, value[r->quantity],
+				  now))
+			continue;
+
+		e.stamp = s->stamp[r->quantity == CSV_DP ? CSV_RH
+							 : r->quantity];
+		e.value = value[r->quantity];
+		e.bus = w->pi2c;
+		e.rule = i;
+		e.active = w->alert[i].active;
+		PROBE3(csv_alert, w->pi2c, i, e.active);
+		csv_send(&w->event_queue, &e);
+		sent = true;
+	}
+
+	if (sent)
+		sem_post(&csv_queue_sem);
+}
+
+/*
+ * Publish a sample and either hand it to the output thread or fold it
+ * into the current window.
+ */
+static void csv_emit(csv_worker_t *w, csv_sample_t *sample)
+{
+	uint8_t si7021_bits = CSV_BIT(CSV_T1) | CSV_BIT(CSV_RH);
+	uint8_t bmp180_bits = CSV_BIT(CSV_T2) | CSV_BIT(CSV_P);
+
+	csv_check_alerts(w, sample);
+
+	if (csv_shmtab && w->index * 2 + 1 < SHMTAB_MAX_ENTRIES) {
+		int32_t si7021_values[] = { sample->t1, sample->rh };
+		int32_t bmp180_values[] = { sample->t2, sample->p };
+
+		if ((sample->known & si7021_bits) == si7021_bits &&
+		    (sample->fresh & si7021_bits))
+			shmtab_publish(csv_shmtab, w->index * 2 + SHM_SI7021,
+				       w->shm_name[SHM_SI7021], si7021_values,
+				       lengthof(si7021_values),
+				       sample->stamp[CSV_RH].mono,
+				       sample->stamp[CSV_RH].real);
+		if ((sample->known & bmp180_bits) == bmp180_bits &&
+		    (sample->fresh & bmp180_bits))
+			shmtab_publish(csv_shmtab, w->index * 2 + SHM_BMP180,
+				       w->shm_name[SHM_BMP180], bmp180_values,
+				       lengthof(bmp180_values),
+				       sample->stamp[CSV_P].mono,
+				       sample->stamp[CSV_P].real);
+	}
+
+	if (!csv_window) {
+		sample->window = 0;
+		csv_send(&w->queue, sample);
+		sem_post(&csv_queue_sem);
+	} else {
+		/* a sample on the boundary belongs to the next window */
+		uint64_t window = csv_window * 1000000ull;
+		uint64_t elapsed = vclock_now() - w->window_start;
+		if (elapsed >= window) {
+			sample->window = csv_window;
+			csv_stamp_at(&sample->window_stamp, w->window_start);
+			csv_send(&w->queue, sample);
+			sem_post(&csv_queue_sem);
+
+			w->window_start += elapsed - elapsed % window;
+			for (int i = 0; i < CSV_NUM_CHANNELS; i++)
+				stats_reset(&sample->stats[i]);
+		}
+
+		if (sample->fresh & CSV_BIT(CSV_T1))
+			stats_update(&sample->stats[CSV_T1], sample->t1);
+		if (sample->fresh & CSV_BIT(CSV_RH))
+			stats_update(&sample->stats[CSV_RH], sample->rh);
+		if (sample->fresh & CSV_BIT(CSV_T2))
+			stats_update(&sample->stats[CSV_T2], sample->t2);
+		if (sample->fresh & CSV_BIT(CSV_P))
+			stats_update(&sample->stats[CSV_P], sample->p);
+	}
+}
+
+/*
+ * Acquire a single sample, hand it to the output thread and advance
+ * w->timeout to the time the next sample is due.
+ */
+static pt_state_t csv_acquire_lockstep(csv_worker_t *w)
+{
+	csv_sample_t *sample = &w->sample;
+
+	PT_BEGIN(&w->pt);
+	PROBE1(csv_acquire__start, w->pi2c);
+
+	PT_SPAWN_AND_CHECK(&w->si7021.pt,
+			   si7021_get_raw_temp(&w->si7021, &w->raw_temp1));
+	csv_stamp(&sample->stamp[CSV_T1]);
+	sample->t1 = si7021_get_temp(&w->si7021, w->raw_temp1);
+	PT_SPAWN_AND_CHECK(&w->si7021.pt,
+			   si7021_get_raw_humidity(&w->si7021, &w->raw_rh));
+	csv_stamp(&sample->stamp[CSV_RH]);
+
+	/* refresh the cached BMP180 temperature early if it is moving */
+	w->temp_due = !w->bmp180.temp_valid || !csv_temp_refresh ||
+		      vclock_now() - w->temp_stamp >= csv_temp_refresh ||
+		      abs(sample->t1 - w->temp_t1) >= csv_temp_delta;
+	if (w->temp_due)
+		bmp180_invalidate_temp(&w->bmp180);
+	PT_SPAWN_AND_CHECK(&w->bmp180.pt,
+			   bmp180_get_raw_temp(&w->bmp180, &w->raw_temp2));
+	if (w->temp_due) {
+		w->temp_stamp = vclock_now();
+		w->temp_t1 = sample->t1;
+		csv_stamp(&sample->stamp[CSV_T2]);
+	}
+	PT_SPAWN_AND_CHECK(&w->bmp180.pt,
+			   bmp180_get_raw_pressure(&w->bmp180,
+						   &w->raw_pressure));
+	csv_stamp(&sample->stamp[CSV_P]);
+
+	sample->rh = si7021_get_humidity(&w->si7021, w->raw_rh);
+	sample->t2 = bmp180_get_temp(&w->bmp180, w->raw_temp2);
+	sample->p = bmp180_get_pressure(&w->bmp180, w->raw_pressure);
+	sample->bus = w->pi2c;
+	sample->fresh = sample->known = CSV_ALL;
+
+	adaptive_update(&w->adaptive, CSV_T1, sample->t1);
+	adaptive_update(&w->adaptive, CSV_RH, sample->rh);
+	adaptive_update(&w->adaptive, CSV_T2, sample->t2);
+	adaptive_update(&w->adaptive, CSV_P, sample->p);
+	uint64_t interval = adaptive_next_interval(&w->adaptive);
+	sample->interval = interval / 1000000;
+
+	csv_emit(w, sample);
+
+	w->timeout += interval;
+
+	PROBE2(csv_acquire__done, w->pi2c, interval);
+	PT_END();
+}
+
+static uint32_t csv_conversion_time(csv_worker_t *w, unsigned int q)
+{
+	if (q == CSV_T1 || q == CSV_RH)
+		return si7021_conversion_time(&w->si7021, q == CSV_RH);
+
+	return bmp180_conversion_time(&w->bmp180, q == CSV_P);
+}
+
+static pt_state_t csv_start_conversion(csv_worker_t *w, unsigned int q)
+{
+	PT_BEGIN(&w->lane_pt);
+
+	if (q == CSV_T1) {
+		PT_SPAWN_AND_CHECK(&w->si7021.pt,
+				   si7021_start_temp(&w->si7021));
+	} else if (q == CSV_RH) {
+		PT_SPAWN_AND_CHECK(&w->si7021.pt,
+				   si7021_start_humidity(&w->si7021));
+	} else if (q == CSV_T2) {
+		PT_SPAWN_AND_CHECK(&w->bmp180.pt,
+				   bmp180_start_temp(&w->bmp180));
+	} else {
+		PT_SPAWN_AND_CHECK(&w->bmp180.pt,
+				   bmp180_start_pressure(&w->bmp180));
+	}
+
+	PT_END();
+}
+
+static pt_state_t csv_fetch_conversion(csv_worker_t *w, unsigned int q)
+{
+	csv_sample_t *sample = &w->sample;
+
+	PT_BEGIN(&w->lane_pt);
+
+	if (q == CSV_T1) {
+		PT_SPAWN_AND_CHECK(&w->si7021.pt,
+				   si7021_fetch_raw(&w->si7021, &w->raw_temp1));
+		sample->t1 = si7021_get_temp(&w->si7021, w->raw_temp1);
+	} else if (q == CSV_RH) {
+		PT_SPAWN_AND_CHECK(&w->si7021.pt,
+				   si7021_fetch_raw(&w->si7021, &w->raw_rh));
+		sample->rh = si7021_get_humidity(&w->si7021, w->raw_rh);
+	} else if (q == CSV_T2) {
+		PT_SPAWN_AND_CHECK(&w->bmp180.pt,
+				   bmp180_fetch_raw_temp(&w->bmp180,
+							 &w->raw_temp2));
+		sample->t2 = bmp180_get_temp(&w->bmp180, w->raw_temp2);
+	} else {
+		PT_SPAWN_AND_CHECK(&w->bmp180.pt,
+				   bmp180_fetch_raw_pressure(&w->bmp180,
+							     &w->raw_pressure));
+		sample->p = bmp180_get_pressure(&w->bmp180, w->raw_pressure);
+	}
+
+	csv_stamp(&sample->stamp[q]);
+	sample->fresh |= CSV_BIT(q);
+	sample->known |= CSV_BIT(q);
+
+	PT_END();
+}
+
+/*
+ * Work out which quantities are due and queue their conversions on each
+ * device. Humidity goes first on the Si7021 (it is the slowest
+ * conversion) and temperature first on the BMP180 (pressure compensation
+ * needs it).
+ */
+static void csv_plan(csv_worker_t *w)
+{
+	static const uint8_t order[CSV_NUM_CHANNELS] = { CSV_RH, CSV_T1,
+							 CSV_T2, CSV_P };
+	uint8_t due = 0;
+
+	for (int q = 0; q < CSV_NUM_CHANNELS; q++) {
+		uint64_t period = csv_period[q] * 1000000ull;
+
+		if (!period || w->due[q] > w->timeout)
+			continue;
+
+		due |= CSV_BIT(q);
+
+		/* skip any deadlines we have already missed */
+		w->due[q] += period;
+		if (w->due[q] <= w->timeout)
+			w->due[q] += (w->timeout - w->due[q]) / period *
+					 period + period;
+	}
+
+	if ((due & CSV_BIT(CSV_P)) && !(w->sample.known & CSV_BIT(CSV_T2)))
+		due |= CSV_BIT(CSV_T2);
+
+	memset(w->lane, 0, sizeof(w->lane));
+	for (int i = 0; i < CSV_NUM_CHANNELS; i++) {
+		int q = order[i];
+		csv_lane_t *l = &w->lane[q == CSV_T1 || q == CSV_RH
+					     ? CSV_LANE_SI7021
+					     : CSV_LANE_BMP180];
+
+		if (due & CSV_BIT(q))
+			l->op[l->num_ops++] = q;
+	}
+}
+
+static unsigned int csv_lane_op(csv_worker_t *w)
+{
+	csv_lane_t *l = &w->lane[w->lane_sel];
+
+	return l->op[l->next];
+}
+
+static void csv_lane_started(csv_worker_t *w)
+{
+	w->lane[w->lane_sel].ready =
+	    vclock_now() + csv_conversion_time(w, csv_lane_op(w));
+}
+
+/*
+ * Select the lane whose conversion completes first, returning false when
+ * every lane is finished.
+ */
+static bool csv_next_lane(csv_worker_t *w)
+{
+	bool found = false;
+
+	for (unsigned int i = 0; i < CSV_NUM_LANES; i++) {
+		csv_lane_t *l = &w->lane[i];
+
+		if (l->next >= l->num_ops)
+			continue;
+
+		if (!found || l->ready < w->lane[w->lane_sel].ready)
+			w->lane_sel = i;
+		found = true;
+	}
+
+	return found;
+}
+
+/*
+ * Multi-rate version of csv_acquire_lockstep(). Conversions on the two
+ * devices run concurrently and each is collected as soon as it is ready.
+ */
+static pt_state_t csv_acquire_multirate(csv_worker_t *w)
+{
+	csv_sample_t *sample = &w->sample;
+
+	PT_BEGIN(&w->pt);
+	PROBE1(csv_acquire__start, w->pi2c);
+
+	sample->fresh = 0;
+	csv_plan(w);
+
+	/* start the first conversion on each device */
+	for (w->lane_sel = 0; w->lane_sel < CSV_NUM_LANES; w->lane_sel++) {
+		if (!w->lane[w->lane_sel].num_ops)
+			continue;
+
+		PT_SPAWN_AND_CHECK(&w->lane_pt,
+				   csv_start_conversion(w, csv_lane_op(w)));
+		csv_lane_started(w);
+	}
+
+	/* collect each result as it becomes ready */
+	while (csv_next_lane(w)) {
+		int64_t wait = w->lane[w->lane_sel].ready - vclock_now();
+
+		if (wait > 0)
+			i2c_ctx_usleep(wait);
+
+		PT_SPAWN_AND_CHECK(&w->lane_pt,
+				   csv_fetch_conversion(w, csv_lane_op(w)));
+		csv_lane_t *l = &w->lane[w->lane_sel];
+		if (++l->next < l->num_ops) {
+			PT_SPAWN_AND_CHECK(
+			    &w->lane_pt, csv_start_conversion(w, csv_lane_op(w)));
+			csv_lane_started(w);
+		}
+	}
+
+	/* the next tick is the earliest deadline */
+	uint64_t next = UINT64_MAX;
+	for (int q = 0; q < CSV_NUM_CHANNELS; q++)
+		if (csv_period[q] && w->due[q] < next)
+			next = w->due[q];
+
+	uint64_t interval = next - w->timeout;
+	sample->interval = interval / 1000000;
+	sample->bus = w->pi2c;
+	if (sample->fresh)
+		csv_emit(w, sample);
+
+	w->timeout = next;
+
+	PROBE2(csv_acquire__done, w->pi2c, interval);
+	PT_END();
+}
+
+static pt_state_t csv_acquire(csv_worker_t *w)
+{
+	return csv_multirate() ? csv_acquire_multirate(w)
+			       : csv_acquire_lockstep(w);
+}
+
+static void csv_wake(csv_worker_t *w)
+{
+	int64_t lateness = vclock_now() - w->timeout;
+
+	PROBE2(csv_wake, w->pi2c, lateness);
+	jitter_record(&w->jitter, lateness);
+}
+
+/*
+ * Worker threads have no fibre scheduler; they run each protothread to
+ * completion and sleep between samples.
+ */
+static bool csv_run(csv_worker_t *w, pt_state_t (*fn)(csv_worker_t *))
+{
+	pt_state_t state;
+
+	memset(&w->pt, 0, sizeof(w->pt));
+	while (PT_WAITING == (state = fn(w)) || PT_YIELDED == state)
+		sched_yield();
+
+	return PT_EXITED == state;
+}
+
+static void csv_sleep_until(uint64_t deadline)
+{
+	uint64_t now = time_now();
+	struct timespec ts;
+
+	if (vclock_enabled()) {
+		vclock_advance_to(deadline);
+		return;
+	}
+
+	if (deadline <= now)
+		return;
+
+	ts.tv_sec = (deadline - now) / 1000000;
+	ts.tv_nsec = ((deadline - now) % 1000000) * 1000;
+	while (0 != nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static void *csv_worker_thread(void *arg)
+{
+	csv_worker_t *w = arg;
+
+	if (csv_run(w, csv_init)) {
+		while (!vclock_expired() && csv_run(w, csv_acquire)) {
+			csv_sleep_until(w->timeout);
+			csv_wake(w);
+		}
+	}
+
+	if (!vclock_expired()) {
+		fprintf(stderr, "Acquisition failed on bus %u\n", w->pi2c);
+		atomic_fetch_add(&csv_num_failed, 1);
+	}
+	w->running = false;
+	atomic_fetch_sub(&csv_num_threads, 1);
+	return NULL;
+}
+
+static pt_state_t console_publish(console_t *c)
+{
+	if (c->argc > 2) {
+		fprintf(c->out, "Usage: publish [<shm-name>]\n");
+		return PT_EXITED;
+	}
+
+	csv_shmtab =
+	    shmtab_create(c->argc == 2 ? c->argv[1] : SHMTAB_DEFAULT_NAME);
+	return csv_shmtab ? PT_EXITED : PT_FAILED;
+}
+static const console_cmd_t cmd_publish =
+    CONSOLE_CMD_VAR_INIT("publish", console_publish);
+
+static pt_state_t console_latest(console_t *c)
+{
+	const shmtab_t *t;
+	shmtab_entry_t e;
+
+	if (c->argc > 2) {
+		fprintf(c->out, "Usage: latest [<shm-name>]\n");
+		return PT_EXITED;
+	}
+
+	t = shmtab_open(c->argc == 2 ? c->argv[1] : SHMTAB_DEFAULT_NAME);
+	if (!t)
+		return PT_FAILED;
+
+	for (unsigned int i = 0; i < SHMTAB_MAX_ENTRIES; i++) {
+		if (!shmtab_read(t, i, &e))
+			continue;
+
+		fprintf(c->out, "%.*s,%llu,%llu.%06llu", (int) sizeof(e.name),
+			e.name, (unsigned long long) e.count,
+			(unsigned long long) (e.real / 1000000000),
+			(unsigned long long) (e.real % 1000000000) / 1000);
+		for (unsigned int j = 0; j < e.nvalues; j++)
+			fprintf(c->out, ",%d", e.value[j]);
+		fprintf(c->out, "\n");
+	}
+
+	munmap((void *) t, sizeof(*t));
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_latest =
+    CONSOLE_CMD_VAR_INIT("latest", console_latest);
+
+static void csv_print_jitter(FILE *f, csv_worker_t *w)
+{
+	jitter_t *j = &w->jitter;
+
+	fprintf(f, "Bus %u samples: %u\n", w->pi2c, j->count);
+	fprintf(f, "Lateness (us): min %lld mean %lld max %lld p99 %lld\n",
+		(long long) j->min, (long long) jitter_mean(j),
+		(long long) j->max, (long long) jitter_percentile(j, 99));
+}
+
+/*
+ * The console is not available while csv runs (the workers share the bus
+ * and the configuration with the other commands) so the jitter statistics
+ * are reported on stderr when acquisition ends.
+ */
 static pt_state_t console_csv(console_t *c)
 {
-	static si7021_t si7021;
-	static uint16_t raw_temp1, raw_rh;
-	static bmp180_t bmp180;
-	static uint16_t raw_temp2;
-	static uint32_t raw_pressure;
-	static uint64_t start, timeout;
+	static csv_worker_t *w;
+	static uint64_t timeout;
+	static bool ok;
 
 	PT_BEGIN(&c->pt);
 
-	PT_SPAWN_AND_CHECK(&si7021.pt, si7021_init(&si7021, pi2c));
-	PT_SPAWN_AND_CHECK(&bmp180.pt, bmp180_init(&bmp180, pi2c));
+	PT_FAIL_ON(0 != csv_output_start());
 
-	start = timeout = time_now();
-	(void) start;
+	if (c->argc > 1) {
+		/* one thread per bus */
+		for (int i = 1; i < c->argc; i++) {
+			w = csv_worker_get(strtol(c->argv[i], NULL, 0));
+			if (!w || w->running)
+				continue;
 
-	while (1) {
-		PT_SPAWN_AND_CHECK(&si7021.pt,
-				   si7021_get_raw_temp(&si7021, &raw_temp1));
-		PT_SPAWN_AND_CHECK(&si7021.pt,
-				   si7021_get_raw_humidity(&si7021, &raw_rh));
-		PT_SPAWN_AND_CHECK(&bmp180.pt,
-				   bmp180_get_raw_temp(&bmp180, &raw_temp2));
-		PT_SPAWN_AND_CHECK(&bmp180.pt, 
-				   bmp180_get_raw_pressure(&bmp180,
-					                   &raw_pressure));
-
-		int t1 = si7021_get_temp(&si7021, raw_temp1);
-		int rh = si7021_get_humidity(&si7021, raw_rh);
-		int dp = dew_point(t1, rh);
-		int t2 = bmp180_get_temp(&bmp180, raw_temp2);
-		int p = bmp180_get_pressure(&bmp180, raw_pressure);
-
-#if 0
-		int minutes = (timeout - start) / (60 * 1000000);
-		int hours = minutes / 60;
-		minutes %= 60;
-		int days = hours / 24;
-		hours %= 24;
-		printf("%2d,%02d:%02d,%2d.%d,%d,%2d.%d,%3d.%03d,%4.1f\n", days, hours,
-		       minutes, t1 / 10, t1 % 10, rh, t2 / 10, t2 % 10,
-		       p / 1000, p % 1000, dew_point);
-#else
-		char stamp[24];
-		time_t now = time(NULL);
-		strftime(stamp, sizeof(stamp), "%FT%H:%M:%S", localtime(&now));
-		printf("%s,%2d.%d,%d,%2d.%d,%3d.%03d,%2d.%d\n", stamp,
-		       t1 / 10, t1 % 10, rh, t2 / 10, t2 % 10,
-		       p / 1000, p % 1000, dp / 10, dp % 10);
-#endif
-
-		timeout += 5 * 60 * 1000000;
-		PT_WAIT_UNTIL(fibre_timeout(timeout));
+			w->running = true;
+			atomic_fetch_add(&csv_num_threads, 1);
+			if (0 != pthread_create(&w->thread, NULL,
+						csv_worker_thread, w)) {
+				fprintf(stderr, "Cannot start thread for bus "
+						"%u\n", w->pi2c);
+				w->running = false;
+				atomic_fetch_sub(&csv_num_threads, 1);
+				continue;
+			}
+			w->joinable = true;
+		}
+
+		while (atomic_load(&csv_num_threads)) {
+			timeout = time_now() + 1000000;
+			PT_WAIT_UNTIL(fibre_timeout(timeout));
+		}
+
+		for (unsigned int i = 0; i < csv_num_workers; i++) {
+			if (csv_workers[i].joinable) {
+				pthread_join(csv_workers[i].thread, NULL);
+				csv_workers[i].joinable = false;
+			}
+		}
+
+		/* threads only stop early if acquisition fails */
+		csv_output_flush();
+		for (unsigned int i = 0; i < csv_num_workers; i++)
+			csv_print_jitter(stderr, &csv_workers[i]);
+		PT_FAIL_ON(atomic_exchange(&csv_num_failed, 0));
+		PT_EXIT();
 	}
 
+	/* single bus, run from this fibre */
+	w = csv_worker_get(pi2c);
+	PT_FAIL_ON(!w || w->running);
+
+	PT_SPAWN(&w->pt, csv_init(w));
+	ok = PT_CHILD_OK();
+
+	while (ok && !vclock_expired()) {
+		PT_SPAWN(&w->pt, csv_acquire(w));
+		ok = PT_CHILD_OK();
+		if (!ok)
+			break;
+
+		/* in virtual time the deadline is reached immediately */
+		vclock_advance_to(w->timeout);
+		PT_WAIT_UNTIL(vclock_enabled() || fibre_timeout(w->timeout));
+		csv_wake(w);
+	}
+
+	csv_output_flush();
+	csv_print_jitter(stderr, w);
+	PT_FAIL_ON(!ok);
 	PT_END();
 }
 static const console_cmd_t cmd_csv =
     CONSOLE_CMD_VAR_INIT("csv", console_csv);
 
+static pt_state_t console_jitter(console_t *c)
+{
+	unsigned int n = atomic_load(&csv_num_workers);
+
+	if (c->argc > 2 ||
+	    (c->argc == 2 && 0 != strcmp(c->argv[1], "reset"))) {
+		fprintf(c->out, "Usage: jitter [reset]\n");
+		return PT_EXITED;
+	}
+
+	for (unsigned int i = 0; i < n; i++) {
+		if (c->argc == 2)
+			jitter_reset(&csv_workers[i].jitter);
+		else
+			csv_print_jitter(c->out, &csv_workers[i]);
+	}
+
+	return PT_EXITED;
+}
+static const console_cmd_t cmd_jitter =
+    CONSOLE_CMD_VAR_INIT("jitter", console_jitter);
+
 
 typedef struct {
 	int argc;
@@ -203,9 +1580,23 @@ int main(int argc, char *argv[])
 
 	console_init(&console, stdout);
 	console_register(&cmd_i2c);
+	console_register(&cmd_adaptive);
+	console_register(&cmd_alert);
+	console_register(&cmd_window);
+	console_register(&cmd_rate);
+	console_register(&cmd_b5cache);
+	console_register(&cmd_trace);
+	console_register(&cmd_replay);
+	console_register(&cmd_vclock);
+	console_register(&cmd_simbus);
+	console_register(&cmd_bme280);
 	console_register(&cmd_bmp180);
 	console_register(&cmd_si7021);
+	console_register(&cmd_si7021res);
 	console_register(&cmd_csv);
+	console_register(&cmd_jitter);
+	console_register(&cmd_publish);
+	console_register(&cmd_latest);
 
 	if (argc > 1) {
 		eval.argc = argc;
@@ -0,0 +1,55 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_PROBE_H_
+#define RF_PROBE_H_
+
+/*!
+ * \defgroup senseimatic_probe Static tracepoints
+ *
+ * \brief USDT probes for perf, bpftrace and SystemTap.
+ *
+ * When <sys/sdt.h> is available each probe compiles to a single nop plus
+ * an ELF note describing its arguments; otherwise the probes compile to
+ * nothing. All probes use the "senseimatic" provider and a double
+ * underscore in a probe name appears as a dash to the tools (for example
+ * senseimatic:rdwr-start).
+ *
+ * @{
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE0(name) DTRACE_PROBE(senseimatic, name)
+#define PROBE1(name, a) DTRACE_PROBE1(senseimatic, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(senseimatic, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(senseimatic, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(senseimatic, name, a, b, c, d)
+#else
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+/*! @} */
+
+#endif // RF_PROBE_H_
@@ -0,0 +1,124 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "shmtab.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void *map(const char *name, int oflag, int prot)
+{
+	void *p;
+
+	int fd = shm_open(name, oflag, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open shared memory: %s\n",
+			strerror(errno));
+		return NULL;
+	}
+
+	if ((oflag & O_CREAT) && 0 != ftruncate(fd, sizeof(shmtab_t))) {
+		fprintf(stderr, "Cannot size shared memory: %s\n",
+			strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, sizeof(shmtab_t), prot, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Cannot map shared memory: %s\n",
+			strerror(errno));
+		return NULL;
+	}
+
+	return p;
+}
+
+shmtab_t *shmtab_create(const char *name)
+{
+	shmtab_t *t = map(name, O_RDWR | O_CREAT, PROT_READ | PROT_WRITE);
+	if (!t)
+		return NULL;
+
+	/* readers may already have the old table mapped */
+	for (unsigned int i = 0; i < SHMTAB_MAX_ENTRIES; i++) {
+		atomic_store(&t->entry[i].seq, 0);
+		t->entry[i].count = 0;
+	}
+	t->version = SHMTAB_VERSION;
+	t->magic = SHMTAB_MAGIC;
+
+	return t;
+}
+
+const shmtab_t *shmtab_open(const char *name)
+{
+	const shmtab_t *t = map(name, O_RDONLY, PROT_READ);
+	if (!t)
+		return NULL;
+
+	if (t->magic != SHMTAB_MAGIC || t->version != SHMTAB_VERSION) {
+		fprintf(stderr, "Bad shared memory table: %s\n", name);
+		munmap((void *) t, sizeof(*t));
+		return NULL;
+	}
+
+	return t;
+}
+
+void shmtab_publish(shmtab_t *t, unsigned int index, const char *name,
+		    const int32_t *value, unsigned int nvalues, uint64_t mono,
+		    uint64_t real)
+{
+	assert(index < SHMTAB_MAX_ENTRIES && nvalues <= SHMTAB_MAX_VALUES);
+	shmtab_entry_t *e = &t->entry[index];
+	unsigned int seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&e->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	strncpy(e->name, name, sizeof(e->name) - 1);
+	e->nvalues = nvalues;
+	e->count++;
+	e->mono = mono;
+	e->real = real;
+	memcpy(e->value, value, nvalues * sizeof(value[0]));
+
+	atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+}
+
+bool shmtab_read(const shmtab_t *t, unsigned int index, shmtab_entry_t *e)
+{
+	assert(index < SHMTAB_MAX_ENTRIES);
+	const shmtab_entry_t *src = &t->entry[index];
+	unsigned int seq;
+
+	do {
+		seq = atomic_load_explicit((atomic_uint *) &src->seq,
+					   memory_order_acquire);
+		if (seq & 1)
+			continue;
+
+		memcpy(e, src, sizeof(*e));
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) ||
+		 seq != atomic_load_explicit((atomic_uint *) &src->seq,
+					     memory_order_relaxed));
+
+	return seq != 0;
+}
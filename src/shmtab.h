@@ -0,0 +1,83 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_SHMTAB_H_
+#define RF_SHMTAB_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHMTAB_DEFAULT_NAME "/senseimatic"
+#define SHMTAB_MAGIC 0x53454e53 // "SENS"
+#define SHMTAB_VERSION 1
+#define SHMTAB_MAX_ENTRIES 8
+#define SHMTAB_MAX_VALUES 4
+
+/*!
+ * \brief Latest calibrated reading from one sensor.
+ *
+ * Each entry is protected by a seqlock; seq is odd while the entry is
+ * being updated.
+ */
+typedef struct shmtab_entry {
+	atomic_uint seq;
+	char name[12];
+	uint32_t nvalues;
+	uint64_t count; //!< Number of readings published
+	uint64_t mono;  //!< CLOCK_MONOTONIC of the reading (ns)
+	uint64_t real;  //!< CLOCK_REALTIME of the reading (ns)
+	int32_t value[SHMTAB_MAX_VALUES];
+} shmtab_entry_t;
+
+/*!
+ * \brief POSIX shared memory table of the latest readings.
+ *
+ * There is a single writer (the acquisition loop) and any number of
+ * readers, none of which touch the I2C bus.
+ */
+typedef struct shmtab {
+	uint32_t magic;
+	uint32_t version;
+	shmtab_entry_t entry[SHMTAB_MAX_ENTRIES];
+} shmtab_t;
+
+//! Create (or reuse) the table for writing. Returns NULL on error.
+shmtab_t *shmtab_create(const char *name);
+
+//! Map an existing table for reading. Returns NULL on error.
+const shmtab_t *shmtab_open(const char *name);
+
+/*!
+ * \brief Publish a new reading.
+ *
+ * Must only be called by the writer.
+ */
+void shmtab_publish(shmtab_t *t, unsigned int index, const char *name,
+		    const int32_t *value, unsigned int nvalues, uint64_t mono,
+		    uint64_t real);
+
+/*!
+ * \brief Take a consistent snapshot of an entry.
+ *
+ * Returns false if nothing has been published to the entry yet.
+ */
+bool shmtab_read(const shmtab_t *t, unsigned int index, shmtab_entry_t *e);
+
+#endif // RF_SHMTAB_H_
@@ -11,14 +11,17 @@
 
 #include "si7021.h"
 
-#include <unistd.h>
-
 #include <librfn.h>
 
+#include "probe.h"
+
 static const uint8_t cmd_measure_rh[] = { 0xe5 };
 static const uint8_t cmd_measure_temp[] = { 0xe3 };
+static const uint8_t cmd_start_rh[] = { 0xf5 };
+static const uint8_t cmd_start_temp[] = { 0xf3 };
 
 static const uint8_t cmd_read_user_reg[] = { 0xe7 };
+static const uint8_t cmd_write_user_reg[] = { 0xe6 };
 static const uint8_t cmd_reset[] = { 0xfe };
 static const uint8_t cmd_read_id1[] = { 0xfa, 0x0f };
 static const uint8_t cmd_read_id2[] = { 0xfc, 0xc9 };
@@ -30,24 +33,48 @@ pt_state_t si7021_init(si7021_t *s, uint32_t pi2c)
 
 	PT_BEGIN(&s->pt);
 
+	/* the cached firmware revision belongs to the device on the old bus */
+	if (s->pi2c != pi2c) {
+		s->pi2c = pi2c;
+		s->fw_rev = 0;
+	}
+
 	/* reset the device (reload settings) */
 	i2c_ctx_init(&s->i2c, pi2c);
 	PT_SPAWN_AND_CHECK(&s->i2c.pt, i2c_ctx_write(&s->i2c, 0x40, cmd_reset,
 						     lengthof(cmd_reset)));
-	usleep(20000);
+	i2c_ctx_usleep(20000);
 
 	i2c_ctx_init(&s->i2c, pi2c);
 	PT_SPAWN_AND_CHECK(&s->i2c.pt,
 			   i2c_ctx_getreg(&s->i2c, 0x40, 0xe7, &val));
 	PT_FAIL_ON(val != 0x3a);
 
+	/* set the resolution (preserving the reserved bits) */
+	if (s->resolution) {
+		i2c_ctx_init(&s->i2c, pi2c);
+		PT_SPAWN_AND_CHECK(
+		    &s->i2c.pt,
+		    i2c_ctx_setreg(&s->i2c, 0x40, cmd_write_user_reg[0],
+				   (0x3a & ~SI7021_RES_MASK) |
+				       (s->resolution & SI7021_RES_MASK)));
+	}
 
-	/* check the firmware revision */
-	i2c_ctx_init(&s->i2c, pi2c);
-	PT_SPAWN_AND_CHECK(&s->i2c.pt,
-			   i2c_ctx_write_read(&s->i2c, 0x40, cmd_fw_rev,
-					      lengthof(cmd_fw_rev), s->reply, 1));
-	PT_FAIL_ON(s->reply[0] != 0xff && s->reply[0] != 0x20);
+
+	/*
+	 * Check the firmware revision. This is a two byte command rather
+	 * than a register read so it is cached here rather than by the
+	 * register cache.
+	 */
+	if (!s->fw_rev) {
+		i2c_ctx_init(&s->i2c, pi2c);
+		PT_SPAWN_AND_CHECK(&s->i2c.pt,
+				   i2c_ctx_write_read(&s->i2c, 0x40, cmd_fw_rev,
+						      lengthof(cmd_fw_rev),
+						      s->reply, 1));
+		PT_FAIL_ON(s->reply[0] != 0xff && s->reply[0] != 0x20);
+		s->fw_rev = s->reply[0];
+	}
 
 	/*
 	 * Trying to access the serial number causes my device to jam with
@@ -70,13 +97,16 @@ pt_state_t si7021_init(si7021_t *s, uint32_t pi2c)
 pt_state_t si7021_get_raw_temp(si7021_t *s, uint16_t *raw_temp)
 {
 	PT_BEGIN(&s->pt);
+	PROBE0(si7021_temp__start);
 
 	PT_SPAWN_AND_CHECK(&s->i2c.pt,
 			   i2c_ctx_write_read(&s->i2c, 0x40, cmd_measure_temp,
 					      lengthof(cmd_measure_temp),
 					      s->reply, 3));
 
-	*raw_temp = (s->reply[0] << 8) + s->reply[1];
+	/* bottom two bits are status, not data */
+	*raw_temp = ((s->reply[0] << 8) + s->reply[1]) & 0xfffc;
+	PROBE1(si7021_temp__done, *raw_temp);
 	PT_END();
 }
 
@@ -88,16 +118,82 @@ int si7021_get_temp(si7021_t *s, uint16_t raw_temp)
 pt_state_t si7021_get_raw_humidity(si7021_t *s, uint16_t *raw_rh)
 {
 	PT_BEGIN(&s->pt);
+	PROBE0(si7021_humidity__start);
 
 	PT_SPAWN_AND_CHECK(&s->i2c.pt,
 			   i2c_ctx_write_read(&s->i2c, 0x40, cmd_measure_rh,
 					      lengthof(cmd_measure_rh),
 					      s->reply, 3));
 
-	*raw_rh = (s->reply[0] << 8) + s->reply[1];
+	*raw_rh = ((s->reply[0] << 8) + s->reply[1]) & 0xfffc;
+	PROBE1(si7021_humidity__done, *raw_rh);
+	PT_END();
+}
+
+pt_state_t si7021_start_temp(si7021_t *s)
+{
+	PT_BEGIN(&s->pt);
+	PROBE0(si7021_temp__start);
+
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_write(&s->i2c, 0x40, cmd_start_temp,
+					 lengthof(cmd_start_temp)));
+
 	PT_END();
 }
 
+pt_state_t si7021_start_humidity(si7021_t *s)
+{
+	PT_BEGIN(&s->pt);
+	PROBE0(si7021_humidity__start);
+
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_write(&s->i2c, 0x40, cmd_start_rh,
+					 lengthof(cmd_start_rh)));
+
+	PT_END();
+}
+
+pt_state_t si7021_fetch_raw(si7021_t *s, uint16_t *raw)
+{
+	PT_BEGIN(&s->pt);
+
+	PT_SPAWN_AND_CHECK(&s->i2c.pt,
+			   i2c_ctx_read(&s->i2c, 0x40, s->reply, 3));
+
+	*raw = ((s->reply[0] << 8) + s->reply[1]) & 0xfffc;
+	PROBE1(si7021_fetch__done, *raw);
+	PT_END();
+}
+
+uint32_t si7021_conversion_time(si7021_t *s, bool humidity)
+{
+	/* worst case conversion times (us) from the datasheet */
+	uint32_t t, rh;
+
+	switch (s->resolution & SI7021_RES_MASK) {
+	case SI7021_RES_RH8_T12:
+		rh = 3100;
+		t = 3800;
+		break;
+	case SI7021_RES_RH10_T13:
+		rh = 4500;
+		t = 6200;
+		break;
+	case SI7021_RES_RH11_T11:
+		rh = 7000;
+		t = 2400;
+		break;
+	default:
+		rh = 12000;
+		t = 10800;
+		break;
+	}
+
+	/* a humidity measurement includes a temperature conversion */
+	return humidity ? rh + t : t;
+}
+
 int si7021_get_humidity(si7021_t *s, uint16_t raw_rh)
 {
 	int rh = (125 * raw_rh / 65536) - 6;
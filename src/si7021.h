@@ -26,19 +26,53 @@
 
 #include "i2c_ctx.h"
 
+/* Measurement resolution (user register bits 7 and 0) */
+#define SI7021_RES_RH12_T14 0x00
+#define SI7021_RES_RH8_T12 0x01
+#define SI7021_RES_RH10_T13 0x80
+#define SI7021_RES_RH11_T11 0x81
+#define SI7021_RES_MASK 0x81
+
 typedef struct si7021 {
 	pt_t pt;      //!< Protothread state
 	i2c_ctx_t i2c;
 
 	uint8_t reply[8];
 
-	
+	uint32_t pi2c;      //!< Bus fw_rev was read from
+	uint8_t resolution; //!< SI7021_RES_* code applied by si7021_init()
+	uint8_t fw_rev;     //!< Firmware revision (0 until read)
 } si7021_t;
 
+/*!
+ * \brief Reset and check the device then apply the requested resolution.
+ *
+ * Lower resolutions convert faster (RH 8-bit/T 12-bit is roughly 7ms
+ * combined against 23ms at the default RH 12-bit/T 14-bit). Measurements
+ * use hold master mode so the device stretches the clock for however long
+ * the conversion takes and results are always left justified; no other
+ * changes are needed at lower resolutions.
+ */
 pt_state_t si7021_init(si7021_t *s, uint32_t pi2c);
 pt_state_t si7021_get_raw_temp(si7021_t *s, uint16_t *raw_temp);
 int si7021_get_temp(si7021_t *s, uint16_t raw_temp);
 pt_state_t si7021_get_raw_humidity(si7021_t *s, uint16_t *raw_rh);
+
+/*!
+ * \brief Start a conversion without holding the bus.
+ *
+ * The result must be collected with si7021_fetch_raw() once
+ * si7021_conversion_time() has elapsed. Until then the device does not
+ * acknowledge reads so the bus can be used to talk to other devices while
+ * the conversion runs.
+ */
+pt_state_t si7021_start_temp(si7021_t *s);
+pt_state_t si7021_start_humidity(si7021_t *s);
+pt_state_t si7021_fetch_raw(si7021_t *s, uint16_t *raw);
+
+//! Worst case conversion time (us) at the configured resolution.
+uint32_t si7021_conversion_time(si7021_t *s, bool humidity);
+
 int si7021_get_humidity(si7021_t *s, uint16_t raw_rh);
 
 #endif // RF_SI7021_H_
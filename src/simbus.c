@@ -0,0 +1,185 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "simbus.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <librfn.h>
+
+#include "vclock.h"
+
+typedef struct simbus {
+	uint32_t pi2c;
+	bool valid;
+
+	uint8_t si7021_cmd;
+	uint8_t si7021_user_reg;
+
+	uint8_t bmp180_ptr;
+	uint8_t bmp180_reg[256];
+} simbus_t;
+
+static simbus_t buses[I2C_CTX_MAX_BUSES];
+
+/* calibration from the BMP180 datasheet example (ac1..md) */
+static const int32_t bmp180_calibration[] = {
+	408, -72, -14383, 32741, 32757, 23153,
+	6190, 4, -32768, -8711, 2868,
+};
+
+static void put16(uint8_t *p, uint16_t val)
+{
+	p[0] = val >> 8;
+	p[1] = val;
+}
+
+static simbus_t *simbus_get(uint32_t pi2c)
+{
+	simbus_t *b;
+
+	for (unsigned int i = 0; i < lengthof(buses); i++)
+		if (buses[i].valid && buses[i].pi2c == pi2c)
+			return &buses[i];
+
+	for (b = buses; b < buses + lengthof(buses); b++)
+		if (!b->valid)
+			break;
+	if (b == buses + lengthof(buses))
+		return NULL;
+
+	memset(b, 0, sizeof(*b));
+	b->pi2c = pi2c;
+	b->valid = true;
+	b->si7021_user_reg = 0x3a;
+	b->bmp180_reg[0xd0] = 0x55;
+	for (unsigned int i = 0; i < lengthof(bmp180_calibration); i++)
+		put16(b->bmp180_reg + 0xaa + 2 * i, bmp180_calibration[i]);
+
+	return b;
+}
+
+/* fraction of the way through the current (virtual) day, in radians */
+static double day_angle(void)
+{
+	uint64_t day = 24ull * 60 * 60 * 1000000;
+
+	return 2 * M_PI * (vclock_now() % day) / day;
+}
+
+static void si7021_write(simbus_t *b, const uint8_t *buf, unsigned int len)
+{
+	if (!len)
+		return;
+
+	b->si7021_cmd = buf[0];
+	if (buf[0] == 0xfe)
+		b->si7021_user_reg = 0x3a;
+	else if (buf[0] == 0xe6 && len > 1)
+		b->si7021_user_reg = buf[1];
+}
+
+static void si7021_read(simbus_t *b, uint8_t *buf, unsigned int len)
+{
+	double temp = 20.0 + 5.0 * sin(day_angle());
+	double rh = 50.0 - 10.0 * sin(day_angle());
+	uint16_t raw = 0;
+
+	memset(buf, 0, len);
+
+	switch (b->si7021_cmd) {
+	case 0xe7:
+		buf[0] = b->si7021_user_reg;
+		return;
+	case 0x84:
+		buf[0] = 0x20;
+		return;
+	case 0xe3:
+	case 0xf3:
+		raw = (temp + 46.85) * 65536 / 175.72;
+		break;
+	case 0xe5:
+	case 0xf5:
+		raw = (rh + 6) * 65536 / 125;
+		break;
+	default:
+		return;
+	}
+
+	if (len >= 2)
+		put16(buf, raw & 0xfffc);
+}
+
+static void bmp180_write(simbus_t *b, const uint8_t *buf, unsigned int len)
+{
+	if (!len)
+		return;
+
+	b->bmp180_ptr = buf[0];
+	for (unsigned int i = 1; i < len; i++) {
+		uint8_t reg = b->bmp180_ptr++;
+
+		b->bmp180_reg[reg] = buf[i];
+		if (reg != 0xf4)
+			continue;
+
+		/* conversions complete instantly */
+		if (buf[i] == 0x2e) {
+			put16(b->bmp180_reg + 0xf6, 27898);
+		} else if ((buf[i] & 0x3f) == 0x34) {
+			uint32_t up = 23843 << (8 - (buf[i] >> 6));
+
+			b->bmp180_reg[0xf6] = up >> 16;
+			b->bmp180_reg[0xf7] = up >> 8;
+			b->bmp180_reg[0xf8] = up;
+		}
+	}
+}
+
+static void bmp180_read(simbus_t *b, uint8_t *buf, unsigned int len)
+{
+	for (unsigned int i = 0; i < len; i++)
+		buf[i] = b->bmp180_reg[b->bmp180_ptr++];
+}
+
+int simbus_rdwr(uint32_t pi2c, struct i2c_msg *msgs, unsigned int nmsgs)
+{
+	simbus_t *b = simbus_get(pi2c);
+
+	if (!b) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < nmsgs; i++) {
+		struct i2c_msg *m = &msgs[i];
+		bool rd = m->flags & I2C_M_RD;
+
+		if (m->addr == 0x40) {
+			if (rd)
+				si7021_read(b, m->buf, m->len);
+			else
+				si7021_write(b, m->buf, m->len);
+		} else if (m->addr == 0x77) {
+			if (rd)
+				bmp180_read(b, m->buf, m->len);
+			else
+				bmp180_write(b, m->buf, m->len);
+		} else {
+			errno = ENXIO;
+			return i ? (int) i : -1;
+		}
+	}
+
+	return nmsgs;
+}
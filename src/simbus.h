@@ -0,0 +1,36 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_SIMBUS_H_
+#define RF_SIMBUS_H_
+
+#include "i2c_ctx.h"
+
+/*!
+ * \brief Simulated I2C bus for soak testing.
+ *
+ * Every bus has a Si7021 (0x40) and a BMP180 (0x77); all other addresses
+ * NAK. The Si7021 reports a daily temperature and humidity cycle driven
+ * by vclock_now() and the BMP180 reports the datasheet example readings.
+ *
+ * Pass to i2c_ctx_set_transport().
+ */
+int simbus_rdwr(uint32_t pi2c, struct i2c_msg *msgs, unsigned int nmsgs);
+
+#endif // RF_SIMBUS_H_
@@ -0,0 +1,99 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "spscq.h"
+
+#include <assert.h>
+#include <string.h>
+
+void spscq_init(spscq_t *q, void *base, size_t msg_len,
+		unsigned int queue_len)
+{
+	assert(queue_len && 0 == (queue_len & (queue_len - 1)));
+
+	q->base = base;
+	q->msg_len = msg_len;
+	q->queue_len = queue_len;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->dropped, 0);
+}
+
+static void *slot(spscq_t *q, unsigned int index)
+{
+	return q->base + (index & (q->queue_len - 1)) * q->msg_len;
+}
+
+void spscq_send(spscq_t *q, const void *msg)
+{
+	unsigned int head =
+	    atomic_load_explicit(&q->head, memory_order_relaxed);
+	unsigned int tail =
+	    atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	/*
+	 * When the queue is full we claim the oldest slot by advancing the
+	 * tail ourselves. If this races with the consumer then the consumer
+	 * has made space for us and nothing need be dropped.
+	 */
+	while (head - tail >= q->queue_len) {
+		if (atomic_compare_exchange_weak_explicit(
+			&q->tail, &tail, tail + 1, memory_order_acq_rel,
+			memory_order_acquire)) {
+			atomic_fetch_add_explicit(&q->dropped, 1,
+						  memory_order_relaxed);
+			break;
+		}
+	}
+
+	memcpy(slot(q, head), msg, q->msg_len);
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
+
+bool spscq_receive(spscq_t *q, void *msg)
+{
+	unsigned int tail =
+	    atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	do {
+		unsigned int head =
+		    atomic_load_explicit(&q->head, memory_order_acquire);
+		if (head == tail)
+			return false;
+
+		memcpy(msg, slot(q, tail), q->msg_len);
+
+		/*
+		 * If the producer has dropped this message while we were
+		 * copying it then the copy may be torn; the CAS fails and
+		 * we retry with the new oldest message.
+		 */
+	} while (!atomic_compare_exchange_weak_explicit(
+	    &q->tail, &tail, tail + 1, memory_order_acq_rel,
+	    memory_order_acquire));
+
+	return true;
+}
+
+bool spscq_full(spscq_t *q)
+{
+	unsigned int head =
+	    atomic_load_explicit(&q->head, memory_order_relaxed);
+	unsigned int tail =
+	    atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	return head - tail >= q->queue_len;
+}
+
+unsigned int spscq_dropped(spscq_t *q)
+{
+	return atomic_load_explicit(&q->dropped, memory_order_relaxed);
+}
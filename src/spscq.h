@@ -0,0 +1,78 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_SPSCQ_H_
+#define RF_SPSCQ_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*!
+ * \brief Lock-free single-producer/single-consumer queue.
+ *
+ * Messages are fixed-size and are copied into and out of the queue.
+ * The producer never waits; if the queue is full the oldest message
+ * is discarded and the dropped counter incremented.
+ *
+ * queue_len must be a power of two.
+ */
+typedef struct spscq {
+	uint8_t *base;
+	size_t msg_len;
+	unsigned int queue_len;
+
+	atomic_uint head; //!< Next slot to write (free running)
+	atomic_uint tail; //!< Next slot to read (free running)
+	atomic_uint dropped;
+} spscq_t;
+
+void spscq_init(spscq_t *q, void *base, size_t msg_len,
+		unsigned int queue_len);
+
+/*!
+ * \brief Copy a message into the queue, discarding the oldest if full.
+ *
+ * Must only be called by the producer.
+ */
+void spscq_send(spscq_t *q, const void *msg);
+
+/*!
+ * \brief Copy the oldest message out of the queue.
+ *
+ * Must only be called by the consumer. Returns false if the queue is
+ * empty.
+ */
+bool spscq_receive(spscq_t *q, void *msg);
+
+/*!
+ * \brief Check whether the next send would discard a message.
+ *
+ * Must only be called by the producer; a producer that cannot afford to
+ * lose messages can wait for this to become false before sending.
+ */
+bool spscq_full(spscq_t *q);
+
+/*!
+ * \brief Number of messages discarded because the queue was full.
+ */
+unsigned int spscq_dropped(spscq_t *q);
+
+#endif // RF_SPSCQ_H_
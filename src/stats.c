@@ -0,0 +1,41 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "stats.h"
+
+#include <math.h>
+#include <string.h>
+
+void stats_reset(stats_t *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+void stats_update(stats_t *s, int32_t x)
+{
+	if (!s->count || x < s->min)
+		s->min = x;
+	if (!s->count || x > s->max)
+		s->max = x;
+
+	s->count++;
+	double delta = x - s->mean;
+	s->mean += delta / s->count;
+	s->m2 += delta * (x - s->mean);
+}
+
+double stats_stddev(const stats_t *s)
+{
+	if (s->count < 2)
+		return 0.0;
+
+	return sqrt(s->m2 / (s->count - 1));
+}
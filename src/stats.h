@@ -0,0 +1,45 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_STATS_H_
+#define RF_STATS_H_
+
+#include <stdint.h>
+
+/*!
+ * \brief Streaming summary statistics.
+ *
+ * Mean and variance are accumulated using Welford's algorithm so the
+ * raw samples need not be stored.
+ */
+typedef struct stats {
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	double mean;
+	double m2; //!< Sum of squared differences from the mean
+} stats_t;
+
+void stats_reset(stats_t *s);
+void stats_update(stats_t *s, int32_t x);
+
+//! Sample standard deviation (zero if there are fewer than two samples).
+double stats_stddev(const stats_t *s);
+
+#endif // RF_STATS_H_
@@ -0,0 +1,89 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "vclock.h"
+
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <librfn.h>
+
+static atomic_bool enabled;
+static uint64_t start;
+static uint64_t start_real;
+static uint64_t limit;
+
+/* zero means "not yet used by this thread" */
+static __thread uint64_t now;
+
+void vclock_enable(uint64_t duration)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	start_real = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	start = time_now();
+	limit = duration;
+	now = start;
+	atomic_store(&enabled, true);
+}
+
+void vclock_disable(void)
+{
+	atomic_store(&enabled, false);
+}
+
+bool vclock_enabled(void)
+{
+	return atomic_load(&enabled);
+}
+
+uint64_t vclock_now(void)
+{
+	if (!vclock_enabled())
+		return time_now();
+
+	if (!now)
+		now = start;
+
+	return now;
+}
+
+uint64_t vclock_realtime(void)
+{
+	struct timespec ts;
+
+	if (vclock_enabled())
+		return start_real + (vclock_now() - start) * 1000;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void vclock_advance_to(uint64_t deadline)
+{
+	if (vclock_enabled() && deadline > vclock_now())
+		now = deadline;
+}
+
+void vclock_sleep(uint64_t usec)
+{
+	if (vclock_enabled())
+		now = vclock_now() + usec;
+	else
+		usleep(usec);
+}
+
+bool vclock_expired(void)
+{
+	return vclock_enabled() && limit && vclock_now() - start >= limit;
+}
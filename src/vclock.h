@@ -0,0 +1,69 @@
+/*
+ * Part of senseimatic (protothreaded sensor drivers)
+ *
+ * Copyright (C) 2016 Daniel Thompson <daniel@redfelineninja.org.uk>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RF_VCLOCK_H_
+#define RF_VCLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*!
+ * \brief Virtual clock.
+ *
+ * When enabled, time stands still until something sleeps or waits for a
+ * deadline, at which point the clock jumps straight to the end of the
+ * wait. This allows long acquisition runs to be simulated as fast as the
+ * CPU allows.
+ *
+ * Each thread has its own virtual clock, all starting from the moment the
+ * virtual clock was enabled. When disabled every function falls back to
+ * time_now() and real sleeps.
+ *
+ * All times are in microseconds.
+ */
+
+/*!
+ * \brief Switch to virtual time.
+ *
+ * duration is the length of the simulated run (0 for no limit). Must be
+ * called before any thread starts using the virtual clock.
+ */
+void vclock_enable(uint64_t duration);
+void vclock_disable(void);
+bool vclock_enabled(void);
+
+uint64_t vclock_now(void);
+
+//! Equivalent of CLOCK_REALTIME, in nanoseconds.
+uint64_t vclock_realtime(void);
+
+/*!
+ * \brief Jump to deadline (which may be in the past).
+ *
+ * Has no effect unless the virtual clock is enabled.
+ */
+void vclock_advance_to(uint64_t deadline);
+
+//! Sleep for (or, in virtual time, skip over) usec microseconds.
+void vclock_sleep(uint64_t usec);
+
+//! True once the simulated run has reached the requested duration.
+bool vclock_expired(void);
+
+#endif // RF_VCLOCK_H_